@@ -44,16 +44,25 @@
 // to fail (if nodes become disconnected)
 
 #include "ns3/animation-interface.h"
+#include "ns3/aodv-helper.h"
 #include "ns3/command-line.h"
 #include "ns3/csma-helper.h"
+#include "ns3/dsdv-helper.h"
 #include "ns3/internet-stack-helper.h"
 #include "ns3/ipv4-address-helper.h"
+#include "ns3/ipv4-list-routing-helper.h"
+#include "ns3/ipv4-queue-disc-item.h"
+#include "ns3/ipv4-static-routing-helper.h"
 #include "ns3/mobility-helper.h"
 #include "ns3/olsr-helper.h"
+#include "ns3/olsr-routing-protocol.h"
 #include "ns3/on-off-helper.h"
 #include "ns3/packet-sink-helper.h"
 #include "ns3/packet-sink.h"
+#include "ns3/propagation-delay-model.h"
+#include "ns3/propagation-loss-model.h"
 #include "ns3/qos-txop.h"
+#include "ns3/qos-utils.h"
 #include "ns3/ssid.h"
 #include "ns3/string.h"
 #include "ns3/yans-wifi-channel.h"
@@ -63,6 +72,42 @@
 #include "ns3/internet-module.h"
 #include "ns3/flow-monitor-module.h"
 #include "ns3/rng-seed-manager.h"
+#ifdef NS3_MPI
+#include <mpi.h>
+#endif
+#include "ns3/scheduler.h"
+#include "ns3/map-scheduler.h"
+#include "ns3/system-path.h"
+#include "ns3/trace-helper.h"
+#include "ns3/wifi-mac.h"
+#include "ns3/wifi-net-device.h"
+#include "ns3/wifi-phy.h"
+#include "ns3/wifi-psdu.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstdio>
+#include <cxxabi.h>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <fcntl.h>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <tuple>
+#include <typeindex>
+#include <unistd.h>
 #include <unordered_map>
 
 #define YELLOW_CODE "\033[33m"
@@ -113,179 +158,4809 @@ NS_LOG_COMPONENT_DEFINE("MixedWireless");
 // {
 //     std::cout << "Se ha recibido un paquete en el nodo con " << packet->GetSize() << " bytes." << std::endl;
 // }
-Ipv4AddressHelper ipAddrs;
-class AdHocNetwork
+
+//
+// Scenario parameters.  A single run and every replication of a batch are
+// driven from the same values, only the RngSeedManager run number and the
+// output directory differ.
+//
+struct ScenarioConfig
+{
+    uint32_t backboneNodes = 6;   // Esta es la capa 3
+    uint32_t infraNodes = 6;      // cantidad de hijos de cada nodo de la capa 3 | capa 2
+    uint32_t infrainfraNodes = 0; // cantidad de hijos de cada nodo de la capa 2 | capa 1
+    double stopTime = 100;
+    uint32_t maxapps = 24;
+    std::string tierFanOut;
+    std::string tierDataModes = "OfdmRate54Mbps,OfdmRate24Mbps";
+    std::string tierRateManagers = "constant";
+    std::string tierStandards = "default";
+    std::string tierChannelWidths = "20";
+    std::string tierMaxAmpdu = "65535";
+    std::string tierMaxAmsdu = "0";
+    bool qos = false;
+    uint32_t latencyFlows = 0;
+    bool hopLatency = false;
+    bool macStats = false;
+    bool queueStats = false;
+    double fieldSize = 500;
+    std::string trafficPolicy = "uniform";
+    std::string flowRate = "1Mb/s";
+    uint32_t packetSize = 512;
+    uint32_t hotspotCluster = 1;
+    double appStartTime = 3.0;
+    double olsrWarmup = 0;
+    std::string routing = "olsr";
+    double oracleRange = 0;
+    double oracleInterval = 1.0;
+    bool useCourseChangeCallback = true;
+    uint32_t seed = 1;
+    uint64_t run = 1;
+    bool animation = false;
+    double animStart = 0;
+    double animStop = 0;
+    std::string animNodes;
+    bool animPackets = true;
+    double animPollInterval = 0.25;
+    bool animCompress = false;
+    bool profileEvents = false;
+    bool controlStats = false;
+    std::string scheduler = "map";
+    double sampleInterval = 0;
+    uint32_t sampleBuffer = 65536;
+    std::string statsFormat = "csv";
+    bool flowXml = true;
+    std::string saveTopology;
+    std::string loadTopology;
+    double checkpointInterval = 0;
+    bool resume = false;
+    double convergence = 0;
+    double convergenceInterval = 1.0;
+    uint32_t convergenceMinBatches = 10;
+    std::string metrics;
+    double metricsInterval = 5.0;
+    std::string traceLevel = "full";
+    std::string traceNodes;
+    std::string traceClusters;
+    uint64_t traceBudget = 0;
+    bool sharedChannels = false;
+    double interferenceCutoff = 0;
+    double propagationCacheTolerance = 0;
+    bool coalescedMobility = false;
+    bool lightweightLeaves = false;
+    bool pooledAlloc = false;
+};
+
+//
+// Splits a comma separated list such as "OfdmRate54Mbps,OfdmRate24Mbps".
+//
+static std::vector<std::string>
+SplitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (!item.empty())
+        {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+//
+// Parses a comma separated list of ids such as "0,3,7".
+//
+static std::set<uint32_t>
+ParseIdList(const std::string& list)
+{
+    std::set<uint32_t> ids;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (!item.empty())
+        {
+            ids.insert(std::stoul(item));
+        }
+    }
+    return ids;
+}
+
+//
+// Propagation loss with an interference cutoff.  Receivers farther than
+// MaxRange from the transmitter get a received power far below any PHY
+// sensitivity, so YansWifiChannel::Receive discards them before they reach
+// the PHY state machine and interference tracking, and the Inner model
+// (Friis) is not evaluated for them at all.
+//
+class CutoffPropagationLossModel : public PropagationLossModel
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid =
+            TypeId("ns3::CutoffPropagationLossModel")
+                .SetParent<PropagationLossModel>()
+                .SetGroupName("Propagation")
+                .AddConstructor<CutoffPropagationLossModel>()
+                .AddAttribute("MaxRange",
+                              "Distance (m) beyond which receivers are cut off",
+                              DoubleValue(250.0),
+                              MakeDoubleAccessor(&CutoffPropagationLossModel::m_maxRange),
+                              MakeDoubleChecker<double>(0.0))
+                .AddAttribute("Inner",
+                              "Loss model evaluated for receivers within range",
+                              PointerValue(),
+                              MakePointerAccessor(&CutoffPropagationLossModel::m_inner),
+                              MakePointerChecker<PropagationLossModel>());
+        return tid;
+    }
+
+  private:
+    double DoCalcRxPower(double txPowerDbm,
+                         Ptr<MobilityModel> a,
+                         Ptr<MobilityModel> b) const override
+    {
+        if (CalculateDistanceSquared(a->GetPosition(), b->GetPosition()) >
+            m_maxRange * m_maxRange)
+        {
+            return -1000.0;
+        }
+        return m_inner ? m_inner->CalcRxPower(txPowerDbm, a, b) : txPowerDbm;
+    }
+
+    int64_t DoAssignStreams(int64_t stream) override
+    {
+        return m_inner ? m_inner->AssignStreams(stream) : 0;
+    }
+
+    double m_maxRange;
+    Ptr<PropagationLossModel> m_inner;
+};
+
+NS_OBJECT_ENSURE_REGISTERED(CutoffPropagationLossModel);
+
+//
+// Hits and misses of all CachedPropagationLossModel instances.  One call in
+// TIMING_PERIOD is timed, so the mean cost of a hit can be compared with
+// that of the Inner model alone (timed inside the misses).
+//
+struct PropagationCacheStats
+{
+    static const uint32_t TIMING_PERIOD = 256;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t timedHits = 0;
+    uint64_t timedMisses = 0;
+    double hitSeconds = 0;
+    double innerSeconds = 0;
+
+    double GetHitNs() const
+    {
+        return timedHits > 0 ? hitSeconds * 1e9 / timedHits : 0;
+    }
+
+    double GetInnerNs() const
+    {
+        return timedMisses > 0 ? innerSeconds * 1e9 / timedMisses : 0;
+    }
+};
+
+static PropagationCacheStats g_propagationCache;
+
+//
+// Caches the loss of the Inner model per ordered pair of nodes.  Between
+// course changes both ends move at constant velocity, so the pair distance
+// drifts by at most their relative speed times the elapsed time: a cached
+// loss is reused until that bound reaches Tolerance metres, or until either
+// end reports a course change, without querying any position.  Nodes get
+// dense slots of their own in each instance on first sight, so a cluster's
+// channel holds its own pairs only.  The loss must not depend on the
+// transmit power, which holds for Friis; a cut off pair keeps a loss far
+// below any sensitivity.
+//
+class CachedPropagationLossModel : public PropagationLossModel
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid =
+            TypeId("ns3::CachedPropagationLossModel")
+                .SetParent<PropagationLossModel>()
+                .SetGroupName("Propagation")
+                .AddConstructor<CachedPropagationLossModel>()
+                .AddAttribute("Tolerance",
+                              "Distance drift (m) over which a cached loss is reused",
+                              DoubleValue(1.0),
+                              MakeDoubleAccessor(&CachedPropagationLossModel::m_tolerance),
+                              MakeDoubleChecker<double>(0.0))
+                .AddAttribute("Inner",
+                              "Loss model whose results are cached",
+                              PointerValue(),
+                              MakePointerAccessor(&CachedPropagationLossModel::m_inner),
+                              MakePointerChecker<PropagationLossModel>());
+        return tid;
+    }
+
+  protected:
+    void DoDispose() override
+    {
+        m_inner = nullptr;
+        PropagationLossModel::DoDispose();
+    }
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry
+    {
+        bool valid = false;
+        uint32_t generationA = 0;
+        uint32_t generationB = 0;
+        Time validUntil;
+        double lossDb = 0;
+    };
+
+    double DoCalcRxPower(double txPowerDbm,
+                         Ptr<MobilityModel> a,
+                         Ptr<MobilityModel> b) const override
+    {
+        bool timed = ++m_calls % PropagationCacheStats::TIMING_PERIOD == 0;
+        Clock::time_point start = timed ? Clock::now() : Clock::time_point();
+        uint32_t ia = Index(a);
+        uint32_t ib = Index(b);
+        std::vector<Entry>& row = m_entries[ia];
+        if (row.size() <= ib)
+        {
+            row.resize(ib + 1);
+        }
+        Entry& entry = row[ib];
+        Time now = Simulator::Now();
+        if (entry.valid && now <= entry.validUntil && entry.generationA == m_generations[ia] &&
+            entry.generationB == m_generations[ib])
+        {
+            ++g_propagationCache.hits;
+            double rxPowerDbm = txPowerDbm - entry.lossDb;
+            if (timed)
+            {
+                ++g_propagationCache.timedHits;
+                g_propagationCache.hitSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+            }
+            return rxPowerDbm;
+        }
+
+        ++g_propagationCache.misses;
+        start = timed ? Clock::now() : start;
+        double rxPowerDbm = m_inner->CalcRxPower(txPowerDbm, a, b);
+        if (timed)
+        {
+            ++g_propagationCache.timedMisses;
+            g_propagationCache.innerSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+        }
+        double speed = CalculateDistance(a->GetVelocity(), b->GetVelocity());
+        entry.valid = true;
+        entry.validUntil = speed > 0 ? now + Seconds(m_tolerance / speed) : Time::Max();
+        entry.generationA = m_generations[ia];
+        entry.generationB = m_generations[ib];
+        entry.lossDb = txPowerDbm - rxPowerDbm;
+        return rxPowerDbm;
+    }
+
+    int64_t DoAssignStreams(int64_t stream) override
+    {
+        return m_inner ? m_inner->AssignStreams(stream) : 0;
+    }
+
+    // Slot of a mobility model's node, assigned and subscribed to its
+    // course changes the first time it is seen.
+    uint32_t Index(Ptr<MobilityModel> model) const
+    {
+        auto inserted = m_slots.emplace(model->GetObject<Node>()->GetId(), m_slots.size());
+        uint32_t index = inserted.first->second;
+        if (inserted.second)
+        {
+            m_generations.push_back(0);
+            m_entries.emplace_back();
+            model->TraceConnectWithoutContext(
+                "CourseChange",
+                MakeCallback(&CachedPropagationLossModel::NotifyCourseChange, this).Bind(index));
+        }
+        return index;
+    }
+
+    void NotifyCourseChange(uint32_t index, Ptr<const MobilityModel>) const
+    {
+        ++m_generations[index];
+    }
+
+    double m_tolerance;
+    Ptr<PropagationLossModel> m_inner;
+    mutable std::unordered_map<uint32_t, uint32_t> m_slots; // node id to slot
+    mutable std::vector<uint32_t> m_generations;           // by slot
+    mutable std::vector<std::vector<Entry>> m_entries;     // by transmitter and receiver slot
+    mutable uint64_t m_calls = 0;
+};
+
+NS_OBJECT_ENSURE_REGISTERED(CachedPropagationLossModel);
+
+//
+// Ad hoc channel with Friis loss and constant speed delay.  Receivers are
+// cut off at interferenceCutoff metres when that is set, and the results
+// are cached when propagationCacheTolerance is set.  The cache goes
+// outside the cutoff so a hit skips its position queries as well; a pair
+// then crosses the cutoff range up to the tolerance late.
+//
+static Ptr<YansWifiChannel>
+CreateWifiChannel(const ScenarioConfig& config)
+{
+    Ptr<PropagationLossModel> loss = CreateObject<FriisPropagationLossModel>();
+    if (config.interferenceCutoff > 0)
+    {
+        loss = CreateObjectWithAttributes<CutoffPropagationLossModel>(
+            "MaxRange",
+            DoubleValue(config.interferenceCutoff),
+            "Inner",
+            PointerValue(loss));
+    }
+    if (config.propagationCacheTolerance > 0)
+    {
+        loss = CreateObjectWithAttributes<CachedPropagationLossModel>(
+            "Tolerance",
+            DoubleValue(config.propagationCacheTolerance),
+            "Inner",
+            PointerValue(loss));
+    }
+    Ptr<YansWifiChannel> channel = CreateObject<YansWifiChannel>();
+    channel->SetPropagationLossModel(loss);
+    channel->SetPropagationDelayModel(CreateObject<ConstantSpeedPropagationDelayModel>());
+    return channel;
+}
+
+//
+// Hierarchical mobility without walking the hierarchy on every query.  The
+// absolute position and velocity (Child relative to Parent) are composed
+// once whenever either end changes course, and positions in between are
+// extrapolated from them.  Both ends move at constant velocity between
+// course changes (random waypoint legs), so the extrapolation is exact;
+// all queries at one instant, e.g. per receiver of a packet, return the
+// same stored position.
+//
+class CoalescedHierarchicalMobilityModel : public MobilityModel
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid = TypeId("ns3::CoalescedHierarchicalMobilityModel")
+                                .SetParent<MobilityModel>()
+                                .SetGroupName("Mobility")
+                                .AddConstructor<CoalescedHierarchicalMobilityModel>();
+        return tid;
+    }
+
+    void SetChild(Ptr<MobilityModel> child)
+    {
+        m_child = child;
+        m_child->TraceConnectWithoutContext(
+            "CourseChange",
+            MakeCallback(&CoalescedHierarchicalMobilityModel::NotifyEndChanged, this));
+        Compose();
+    }
+
+    void SetParent(Ptr<MobilityModel> parent)
+    {
+        m_parent = parent;
+        m_parent->TraceConnectWithoutContext(
+            "CourseChange",
+            MakeCallback(&CoalescedHierarchicalMobilityModel::NotifyEndChanged, this));
+        Compose();
+    }
+
+  protected:
+    void DoInitialize() override
+    {
+        // The parent belongs to (and is initialized by) the gateway node
+        m_child->Initialize();
+        MobilityModel::DoInitialize();
+    }
+
+    void DoDispose() override
+    {
+        m_child = nullptr;
+        m_parent = nullptr;
+        MobilityModel::DoDispose();
+    }
+
+  private:
+    void NotifyEndChanged(Ptr<const MobilityModel>)
+    {
+        Compose();
+        NotifyCourseChange();
+    }
+
+    void Compose()
+    {
+        if (!m_child || !m_parent)
+        {
+            return;
+        }
+        Vector child = m_child->GetPosition();
+        Vector parent = m_parent->GetPosition();
+        Vector childVelocity = m_child->GetVelocity();
+        Vector parentVelocity = m_parent->GetVelocity();
+        m_base = Vector(child.x + parent.x, child.y + parent.y, child.z + parent.z);
+        m_velocity = Vector(childVelocity.x + parentVelocity.x,
+                            childVelocity.y + parentVelocity.y,
+                            childVelocity.z + parentVelocity.z);
+        m_baseTime = Simulator::Now();
+        m_position = m_base;
+        m_positionTime = m_baseTime;
+    }
+
+    Vector DoGetPosition() const override
+    {
+        Time now = Simulator::Now();
+        if (now != m_positionTime)
+        {
+            double dt = (now - m_baseTime).GetSeconds();
+            m_position = Vector(m_base.x + m_velocity.x * dt,
+                                m_base.y + m_velocity.y * dt,
+                                m_base.z + m_velocity.z * dt);
+            m_positionTime = now;
+        }
+        return m_position;
+    }
+
+    // Same choice as HierarchicalMobilityModel: the child absorbs the move
+    void DoSetPosition(const Vector& position) override
+    {
+        if (!m_child || !m_parent)
+        {
+            return;
+        }
+        Vector parent = m_parent->GetPosition();
+        m_child->SetPosition(Vector(position.x - parent.x, position.y - parent.y, position.z - parent.z));
+        // The child only reports a course change once its walk restarts
+        Compose();
+    }
+
+    Vector DoGetVelocity() const override
+    {
+        return m_velocity;
+    }
+
+    int64_t DoAssignStreams(int64_t stream) override
+    {
+        return m_child->AssignStreams(stream);
+    }
+
+    Ptr<MobilityModel> m_child;
+    Ptr<MobilityModel> m_parent;
+    Vector m_base;
+    Vector m_velocity;
+    Time m_baseTime;
+    mutable Vector m_position;
+    mutable Time m_positionTime;
+};
+
+NS_OBJECT_ENSURE_REGISTERED(CoalescedHierarchicalMobilityModel);
+
+//
+// One level of the cluster tree.  Level 0 is the backbone with fanOut
+// routers; on every deeper level each node of the level above is the
+// gateway of a cluster of fanOut new nodes.
+//
+struct TierSpec
+{
+    uint32_t fanOut;
+    std::string dataMode;    // data mode of the constant rate manager
+    std::string rateManager; // constant, minstrel or ideal
+    std::string standard;    // default, 80211a, 80211g, 80211n, 80211ac or 80211ax
+    uint16_t channelWidth;   // MHz
+    uint32_t maxAmpdu;       // bytes, 0 disables A-MPDU (HT and later only)
+    uint32_t maxAmsdu;       // bytes, 0 disables A-MSDU (HT and later only)
+
+    // 802.11n and later: QoS MAC with block ack and aggregation
+    bool IsHighThroughput() const
+    {
+        return standard == "80211n" || standard == "80211ac" || standard == "80211ax";
+    }
+};
+
+//
+// Tier list from tierFanOut ("6,6,2") or, when that is empty, from
+// backboneNodes/infraNodes/infrainfraNodes.  The description stops at the
+// first level with no nodes, and the last entry of every per-level list
+// (data mode, rate manager, standard, width, aggregation sizes) applies to
+// every deeper level.
+//
+static std::vector<TierSpec>
+MakeTiers(const ScenarioConfig& config)
+{
+    std::vector<uint32_t> fanOut;
+    if (config.tierFanOut.empty())
+    {
+        fanOut = {config.backboneNodes, config.infraNodes, config.infrainfraNodes};
+    }
+    else
+    {
+        for (const std::string& item : SplitList(config.tierFanOut))
+        {
+            fanOut.push_back(std::stoul(item));
+        }
+    }
+    std::vector<std::string> modes = SplitList(config.tierDataModes);
+    std::vector<std::string> managers = SplitList(config.tierRateManagers);
+    std::vector<std::string> standards = SplitList(config.tierStandards);
+    std::vector<std::string> widths = SplitList(config.tierChannelWidths);
+    std::vector<std::string> ampdu = SplitList(config.tierMaxAmpdu);
+    std::vector<std::string> amsdu = SplitList(config.tierMaxAmsdu);
+    NS_ABORT_MSG_IF(modes.empty(), "tierDataModes must list at least one data mode");
+    NS_ABORT_MSG_IF(managers.empty(), "tierRateManagers must list at least one rate manager");
+    NS_ABORT_MSG_IF(standards.empty() || widths.empty() || ampdu.empty() || amsdu.empty(),
+                    "Every per-level wifi list needs at least one entry");
+    auto perLevel = [](const std::vector<std::string>& values, uint32_t level) {
+        return values[std::min<std::size_t>(level, values.size() - 1)];
+    };
+
+    std::vector<TierSpec> tiers;
+    for (uint32_t level = 0; level < fanOut.size() && fanOut[level] > 0; ++level)
+    {
+        tiers.push_back({fanOut[level],
+                         perLevel(modes, level),
+                         perLevel(managers, level),
+                         perLevel(standards, level),
+                         uint16_t(std::stoul(perLevel(widths, level))),
+                         uint32_t(std::stoul(perLevel(ampdu, level))),
+                         uint32_t(std::stoul(perLevel(amsdu, level)))});
+    }
+    NS_ABORT_MSG_IF(tiers.empty(), "The backbone needs at least one node");
+    return tiers;
+}
+
+//
+// Nodes of one ad hoc cluster.  Cluster 0 is the backbone and has no
+// gateway; every other cluster lists its gateway (the parent router it is
+// attached to) as the last node.  Each cluster owns the /24 returned by
+// ClusterNetwork().
+//
+struct ClusterInfo
+{
+    NodeContainer nodes;
+    Ptr<Node> gateway;
+    uint32_t tier;
+    Ipv4Address network;
+    NetDeviceContainer devices;
+    Ipv4InterfaceContainer interfaces;
+};
+
+//
+// Access category of a packet leaving a QoS MAC: OLSR control (UDP port
+// 698) goes to AC_VO, everything else follows the precedence bits of its
+// DS field as ns-3's SelectQueueByDSField does, so flows sent with TOS EF
+// (0xb8) land in AC_VI and plain traffic in AC_BE.  The chosen user
+// priority is carried to the MAC in the SocketPriorityTag.
+//
+static uint8_t
+SelectAccessCategory(Ptr<QueueItem> item)
+{
+    uint8_t priority = 0;
+    uint8_t dsField = 0;
+    if (item->GetUint8Value(QueueItem::IP_DSFIELD, dsField))
+    {
+        priority = dsField >> 5;
+    }
+    Ptr<Ipv4QueueDiscItem> ipItem = DynamicCast<Ipv4QueueDiscItem>(item);
+    UdpHeader udp;
+    if (ipItem && ipItem->GetHeader().GetProtocol() == UdpL4Protocol::PROT_NUMBER &&
+        item->GetPacket()->PeekHeader(udp) && (udp.GetDestinationPort() == 698 || udp.GetSourcePort() == 698))
+    {
+        priority = 6;
+    }
+    SocketPriorityTag priorityTag;
+    priorityTag.SetPriority(priority);
+    item->GetPacket()->ReplacePacketTag(priorityTag);
+    return QosUtilsMapTidToAc(priority);
+}
+
+//
+// Address block of a cluster: the cluster-th /24 from 192.168.0.0, which is
+// what a single Ipv4AddressHelper calling NewNetwork() after each cluster
+// would hand out, but computed from the cluster number alone.
+//
+static Ipv4Address
+ClusterNetwork(uint32_t cluster)
+{
+    return Ipv4Address(Ipv4Address("192.168.0.0").Get() + (cluster << 8));
+}
+
+//
+// Constructed topology in a form that can be saved and rebuilt: the tiers
+// with their PHY modes, the cluster tree with each cluster's gateway and
+// address block, and the initial position of every node in node id order.
+// Positions are what the mobility helper assigns: absolute on the backbone,
+// relative to the cluster's gateway for the members of child clusters.
+// A loaded snapshot replaces the tier configuration and the initial
+// position draws; the build itself is checked against its cluster tree and
+// positions.
+//
+struct TopologySnapshot
+{
+    struct Cluster
+    {
+        uint32_t tier;
+        int64_t gateway;
+        Ipv4Address network;
+        uint32_t nodes;
+    };
+
+    std::vector<TierSpec> tiers;
+    std::vector<Cluster> clusters;
+    std::vector<Vector> positions;
+
+    bool Save(const std::string& fileName) const
+    {
+        std::ofstream file(fileName);
+        return Write(file);
+    }
+
+    bool Load(const std::string& fileName)
+    {
+        std::ifstream file(fileName);
+        return Read(file);
+    }
+
+    bool Write(std::ostream& file) const
+    {
+        file << std::setprecision(17) << "mixed-wireless-topology 2\n";
+        file << "tiers " << tiers.size() << "\n";
+        for (const TierSpec& tier : tiers)
+        {
+            file << tier.fanOut << " " << tier.dataMode << " " << tier.rateManager << " "
+                 << tier.standard << " " << tier.channelWidth << " " << tier.maxAmpdu << " "
+                 << tier.maxAmsdu << "\n";
+        }
+        file << "clusters " << clusters.size() << "\n";
+        for (const Cluster& cluster : clusters)
+        {
+            file << cluster.tier << " " << cluster.gateway << " ";
+            cluster.network.Print(file);
+            file << " " << cluster.nodes << "\n";
+        }
+        file << "nodes " << positions.size() << "\n";
+        for (const Vector& position : positions)
+        {
+            file << position.x << " " << position.y << " " << position.z << "\n";
+        }
+        return bool(file);
+    }
+
+    bool Read(std::istream& file)
+    {
+        std::string magic;
+        std::string section;
+        uint32_t version = 0;
+        std::size_t count = 0;
+        // Older versions, with absolute positions and fewer tier fields, are refused
+        if (!(file >> magic >> version) || magic != "mixed-wireless-topology" || version != 2)
+        {
+            return false;
+        }
+
+        if (!(file >> section >> count) || section != "tiers")
+        {
+            return false;
+        }
+        tiers.resize(count);
+        for (TierSpec& tier : tiers)
+        {
+            file >> tier.fanOut >> tier.dataMode >> tier.rateManager >> tier.standard >>
+                tier.channelWidth >> tier.maxAmpdu >> tier.maxAmsdu;
+        }
+
+        if (!(file >> section >> count) || section != "clusters")
+        {
+            return false;
+        }
+        clusters.resize(count);
+        for (Cluster& cluster : clusters)
+        {
+            std::string network;
+            file >> cluster.tier >> cluster.gateway >> network >> cluster.nodes;
+            cluster.network = Ipv4Address(network.c_str());
+        }
+
+        if (!(file >> section >> count) || section != "nodes")
+        {
+            return false;
+        }
+        positions.resize(count);
+        for (Vector& position : positions)
+        {
+            file >> position.x >> position.y >> position.z;
+        }
+        return bool(file) && !tiers.empty();
+    }
+};
+
+//
+// Builds the whole cluster tree in one breadth-first pass: clusters are
+// numbered level by level, each level configures its wifi, MAC, PHY and
+// mobility helpers once and reuses them for all of its clusters, and the
+// IPv4 stack with OLSR is installed on every node in a single call.  Child
+// clusters move relative to their gateway through a hierarchical mobility
+// model.
+//
+class HierarchicalNetwork
+{
+  public:
+    HierarchicalNetwork(const ScenarioConfig& config, const TopologySnapshot* snapshot = nullptr)
+        : m_config(config),
+          m_snapshot(snapshot),
+          m_tiers(snapshot ? snapshot->tiers : MakeTiers(config))
+    {
+    }
+
+    //
+    // Builds the network with fixed random streams from stream on: the
+    // position allocator's come first, before any node is placed, then
+    // those of AssignStreams().  Returns the number of streams used.
+    //
+    int64_t Build(int64_t stream)
+    {
+        int64_t current = stream;
+        Ptr<PositionAllocator> positions = CreatePositionAllocator();
+        current += positions->AssignStreams(current);
+        Ptr<PositionAllocator> initialPositions = positions;
+        if (m_snapshot)
+        {
+            Ptr<ListPositionAllocator> saved = CreateObject<ListPositionAllocator>();
+            for (const Vector& position : m_snapshot->positions)
+            {
+                saved->Add(position);
+            }
+            initialPositions = saved;
+        }
+        std::vector<Ptr<YansWifiChannel>> tierChannels(m_tiers.size());
+        uint32_t parentBegin = 0;
+        uint32_t parentEnd = 0;
+        for (uint32_t tier = 0; tier < m_tiers.size(); ++tier)
+        {
+            NS_LOG_INFO("Configuring tier " << tier << " (fan-out " << m_tiers[tier].fanOut << ")");
+            WifiHelper wifi;
+            WifiMacHelper mac;
+            YansWifiPhyHelper wifiPhy;
+            ConfigureWifi(m_tiers[tier], m_config.qos, wifi, mac, wifiPhy);
+            MobilityHelper mobility = CreateMobilityHelper(positions, initialPositions);
+
+            uint32_t begin = m_clusters.size();
+            if (tier == 0)
+            {
+                ClusterInfo backbone;
+                backbone.tier = 0;
+                backbone.network = ClusterNetwork(0);
+                backbone.nodes.Create(m_tiers[0].fanOut);
+                mobility.Install(backbone.nodes);
+                m_clusters.push_back(backbone);
+            }
+            else
+            {
+                for (uint32_t parent = parentBegin; parent < parentEnd; ++parent)
+                {
+                    // Copied: m_clusters grows while the children are added
+                    NodeContainer parentNodes = m_clusters[parent].nodes;
+                    uint32_t members = parentNodes.GetN() - (m_clusters[parent].gateway ? 1 : 0);
+                    for (uint32_t i = 0; i < members; ++i)
+                    {
+                        ClusterInfo cluster;
+                        cluster.tier = tier;
+                        cluster.network = ClusterNetwork(m_clusters.size());
+                        cluster.gateway = parentNodes.Get(i);
+                        cluster.nodes.Create(m_tiers[tier].fanOut);
+                        if (m_config.coalescedMobility)
+                        {
+                            InstallCoalescedMobility(cluster.nodes, cluster.gateway, positions, initialPositions);
+                        }
+                        else
+                        {
+                            mobility.PushReferenceMobilityModel(cluster.gateway);
+                            mobility.Install(cluster.nodes);
+                            mobility.PopReferenceMobilityModel();
+                        }
+                        cluster.nodes.Add(cluster.gateway);
+                        m_clusters.push_back(cluster);
+                    }
+                }
+            }
+
+            for (uint32_t c = begin; c < m_clusters.size(); ++c)
+            {
+                if (!m_config.sharedChannels)
+                {
+                    wifiPhy.SetChannel(CreateWifiChannel(m_config));
+                }
+                else
+                {
+                    if (!tierChannels[tier])
+                    {
+                        tierChannels[tier] = CreateWifiChannel(m_config);
+                    }
+                    wifiPhy.SetChannel(tierChannels[tier]);
+                }
+                m_clusters[c].devices = wifi.Install(wifiPhy, mac, m_clusters[c].nodes);
+            }
+            parentBegin = begin;
+            parentEnd = m_clusters.size();
+        }
+
+        OlsrHelper olsr;
+        AodvHelper aodv;
+        DsdvHelper dsdv;
+        Ipv4StaticRoutingHelper staticRouting;
+        InternetStackHelper internet;
+        if (m_config.routing == "olsr")
+        {
+            if (m_config.olsrWarmup > 0)
+            {
+                olsr.Set("HelloInterval", TimeValue(Seconds(0.1)));
+                olsr.Set("TcInterval", TimeValue(Seconds(0.25)));
+                olsr.Set("MidInterval", TimeValue(Seconds(0.25)));
+                Simulator::Schedule(Seconds(m_config.olsrWarmup), &HierarchicalNetwork::EndOlsrWarmup);
+            }
+            internet.SetRoutingHelper(olsr);
+        }
+        else if (m_config.routing == "aodv")
+        {
+            internet.SetRoutingHelper(aodv);
+        }
+        else if (m_config.routing == "dsdv")
+        {
+            internet.SetRoutingHelper(dsdv);
+        }
+        else if (m_config.routing == "oracle")
+        {
+            // Routes are written by OracleRouting once the addresses exist
+            internet.SetRoutingHelper(staticRouting);
+        }
+        else
+        {
+            NS_ABORT_MSG("Unknown routing " << m_config.routing);
+        }
+
+        NodeContainer routers = NodeContainer::GetGlobal();
+        if (m_config.lightweightLeaves && m_tiers.size() > 1)
+        {
+            NS_ABORT_MSG_IF(m_config.routing != "olsr", "lightweightLeaves needs OLSR routing");
+            routers = NodeContainer();
+            for (const ClusterInfo& cluster : m_clusters)
+            {
+                uint32_t members = cluster.nodes.GetN() - (cluster.gateway ? 1 : 0);
+                bool leaf = cluster.tier == m_tiers.size() - 1;
+                for (uint32_t i = 0; i < members; ++i)
+                {
+                    (leaf ? m_leaves : routers).Add(cluster.nodes.Get(i));
+                }
+            }
+            // Routers keep static routing next to OLSR for the leaf subnets
+            Ipv4ListRoutingHelper list;
+            list.Add(staticRouting, 0);
+            list.Add(olsr, 10);
+            internet.SetRoutingHelper(list);
+            InternetStackHelper leafInternet;
+            leafInternet.SetRoutingHelper(staticRouting);
+            leafInternet.Install(m_leaves);
+        }
+        internet.Install(routers);
+
+        for (ClusterInfo& cluster : m_clusters)
+        {
+            cluster.interfaces = AssignAddresses(cluster);
+        }
+        if (m_leaves.GetN() > 0)
+        {
+            ConfigureLeafClusters();
+        }
+
+        if (m_snapshot)
+        {
+            TopologySnapshot built = GetSnapshot();
+            bool same = built.positions.size() == m_snapshot->positions.size() &&
+                        built.clusters.size() == m_snapshot->clusters.size();
+            for (std::size_t c = 0; same && c < built.clusters.size(); ++c)
+            {
+                const TopologySnapshot::Cluster& a = built.clusters[c];
+                const TopologySnapshot::Cluster& b = m_snapshot->clusters[c];
+                same = a.tier == b.tier && a.gateway == b.gateway && a.network == b.network &&
+                       a.nodes == b.nodes;
+            }
+            for (std::size_t n = 0; same && n < built.positions.size(); ++n)
+            {
+                same = CalculateDistance(built.positions[n], m_snapshot->positions[n]) < 1e-6;
+            }
+            NS_ABORT_MSG_IF(!same, "The loaded topology does not match the network it builds");
+        }
+        current += AssignStreams(current);
+        return current - stream;
+    }
+
+    // Snapshot of the network as built; positions are the current ones.
+    TopologySnapshot GetSnapshot() const
+    {
+        TopologySnapshot snapshot;
+        snapshot.tiers = m_tiers;
+        NodeContainer nodes = NodeContainer::GetGlobal();
+        std::vector<Ptr<Node>> gatewayOf(nodes.GetN());
+        for (const ClusterInfo& cluster : m_clusters)
+        {
+            snapshot.clusters.push_back({cluster.tier,
+                                         cluster.gateway ? int64_t(cluster.gateway->GetId()) : -1,
+                                         cluster.network,
+                                         cluster.nodes.GetN()});
+            uint32_t members = cluster.nodes.GetN() - (cluster.gateway ? 1 : 0);
+            for (uint32_t i = 0; i < members; ++i)
+            {
+                gatewayOf[cluster.nodes.Get(i)->GetId()] = cluster.gateway;
+            }
+        }
+        for (uint32_t i = 0; i < nodes.GetN(); ++i)
+        {
+            Vector position = nodes.Get(i)->GetObject<MobilityModel>()->GetPosition();
+            if (gatewayOf[i])
+            {
+                Vector gateway = gatewayOf[i]->GetObject<MobilityModel>()->GetPosition();
+                position = Vector(position.x - gateway.x, position.y - gateway.y, position.z - gateway.z);
+            }
+            snapshot.positions.push_back(position);
+        }
+        return snapshot;
+    }
+
+    const std::vector<ClusterInfo>& GetClusters() const
+    {
+        return m_clusters;
+    }
+
+    const std::vector<TierSpec>& GetTiers() const
+    {
+        return m_tiers;
+    }
+
+    // Bottom tier nodes built as lightweight leaves (empty unless enabled)
+    const NodeContainer& GetLeaves() const
+    {
+        return m_leaves;
+    }
+
+  private:
+    //
+    // Fix the random streams of the wifi devices (cluster by cluster),
+    // the mobility models, the ARP/IP stack and the routing protocol,
+    // starting at stream.  Together with the seed and run number this
+    // makes a run reproducible regardless of how many random variables
+    // other code creates.  Returns the number of streams used.
+    //
+    int64_t AssignStreams(int64_t stream)
+    {
+        int64_t current = stream;
+        NodeContainer nodes = NodeContainer::GetGlobal();
+        WifiHelper wifi;
+        for (const ClusterInfo& cluster : m_clusters)
+        {
+            current += wifi.AssignStreams(cluster.devices, current);
+        }
+        MobilityHelper mobility;
+        current += mobility.AssignStreams(nodes, current);
+        InternetStackHelper internet;
+        current += internet.AssignStreams(nodes, current);
+        if (m_config.routing == "olsr")
+        {
+            OlsrHelper olsr;
+            current += olsr.AssignStreams(nodes, current);
+        }
+        else if (m_config.routing == "aodv")
+        {
+            AodvHelper aodv;
+            current += aodv.AssignStreams(nodes, current);
+        }
+        return current - stream;
+    }
+
+    //
+    // Standard, channel width, MAC and rate manager of one tier.  HT and
+    // later standards get a QoS MAC, so that best effort traffic can be
+    // aggregated up to maxAmpdu / maxAmsdu bytes under a block ack
+    // agreement, and Minstrel's HT variant.  The constant rate manager
+    // then needs an HtMcs/VhtMcs/HeMcs data mode to send HT frames.  With
+    // qos every tier gets an EDCA MAC and packets are mapped to access
+    // categories by SelectAccessCategory.  The "default" standard leaves
+    // the standard and channel to WifiHelper's defaults, as before the
+    // standard was configurable.
+    //
+    static void ConfigureWifi(const TierSpec& tier,
+                              bool qos,
+                              WifiHelper& wifi,
+                              WifiMacHelper& mac,
+                              YansWifiPhyHelper& phy)
+    {
+        static const std::map<std::string, WifiStandard> standards = {
+            {"80211a", WIFI_STANDARD_80211a},
+            {"80211g", WIFI_STANDARD_80211g},
+            {"80211n", WIFI_STANDARD_80211n},
+            {"80211ac", WIFI_STANDARD_80211ac},
+            {"80211ax", WIFI_STANDARD_80211ax}};
+        SetRateManager(wifi, tier);
+        if (tier.standard != "default")
+        {
+            auto standard = standards.find(tier.standard);
+            NS_ABORT_MSG_IF(standard == standards.end(), "Unknown wifi standard " << tier.standard);
+            wifi.SetStandard(standard->second);
+        }
+
+        if (tier.standard == "80211g")
+        {
+            phy.Set("ChannelSettings", StringValue("{0, 20, BAND_2_4GHZ, 0}"));
+        }
+        else if (tier.standard != "default")
+        {
+            std::ostringstream settings;
+            settings << "{0, " << tier.channelWidth << ", BAND_5GHZ, 0}";
+            phy.Set("ChannelSettings", StringValue(settings.str()));
+        }
+
+        if (tier.IsHighThroughput())
+        {
+            mac.SetType("ns3::AdhocWifiMac",
+                        "QosSupported",
+                        BooleanValue(true),
+                        "BE_MaxAmpduSize",
+                        UintegerValue(tier.maxAmpdu),
+                        "BE_MaxAmsduSize",
+                        UintegerValue(tier.maxAmsdu));
+        }
+        else
+        {
+            mac.SetType("ns3::AdhocWifiMac", "QosSupported", BooleanValue(qos));
+        }
+        if (qos)
+        {
+            wifi.SetSelectQueueCallback(MakeCallback(&SelectAccessCategory));
+        }
+    }
+
+    static void SetRateManager(WifiHelper& wifi, const TierSpec& tier)
+    {
+        if (tier.rateManager == "constant")
+        {
+            wifi.SetRemoteStationManager("ns3::ConstantRateWifiManager",
+                                         "DataMode",
+                                         StringValue(tier.dataMode));
+        }
+        else if (tier.rateManager == "minstrel")
+        {
+            wifi.SetRemoteStationManager(tier.IsHighThroughput() ? "ns3::MinstrelHtWifiManager"
+                                                                 : "ns3::MinstrelWifiManager");
+        }
+        else if (tier.rateManager == "ideal")
+        {
+            wifi.SetRemoteStationManager("ns3::IdealWifiManager");
+        }
+        else
+        {
+            NS_ABORT_MSG("Unknown rate manager " << tier.rateManager);
+        }
+    }
+
+    //
+    // OLSR keeps its neighbour and topology sets private, so they cannot be
+    // seeded.  Instead the warm-up runs OLSR with short Hello/TC/MID
+    // intervals, which converges in a fraction of the default time, and then
+    // restores the RFC 3626 defaults.  Validity times follow the intervals,
+    // and the first message after the switch already carries the long ones.
+    //
+    static void EndOlsrWarmup()
+    {
+        NS_LOG_INFO("OLSR warm-up done at " << Simulator::Now().GetSeconds() << " s");
+        Config::Set("/NodeList/*/$ns3::olsr::RoutingProtocol/HelloInterval", TimeValue(Seconds(2)));
+        Config::Set("/NodeList/*/$ns3::olsr::RoutingProtocol/TcInterval", TimeValue(Seconds(5)));
+        Config::Set("/NodeList/*/$ns3::olsr::RoutingProtocol/MidInterval", TimeValue(Seconds(5)));
+    }
+
+    //
+    // Lightweight leaves run no routing protocol: they only hold a default
+    // route through their gateway.  The gateway keeps OLSR off the leaf
+    // interface and announces the leaf subnet as an HNA instead, so the
+    // rest of the network routes the whole /24 to it.
+    //
+    void ConfigureLeafClusters() const
+    {
+        Ipv4StaticRoutingHelper staticRouting;
+        for (const ClusterInfo& cluster : m_clusters)
+        {
+            if (cluster.tier != m_tiers.size() - 1)
+            {
+                continue;
+            }
+            uint32_t last = cluster.nodes.GetN() - 1;
+            Ipv4Address gatewayAddress = cluster.interfaces.GetAddress(last);
+            Ptr<olsr::RoutingProtocol> olsr = cluster.gateway->GetObject<olsr::RoutingProtocol>();
+            olsr->SetInterfaceExclusions({cluster.interfaces.Get(last).second});
+            olsr->AddHostNetworkAssociation(cluster.network, Ipv4Mask("255.255.255.0"));
+            for (uint32_t i = 0; i < last; ++i)
+            {
+                std::pair<Ptr<Ipv4>, uint32_t> leaf = cluster.interfaces.Get(i);
+                staticRouting.GetStaticRouting(leaf.first)->SetDefaultRoute(gatewayAddress, leaf.second);
+            }
+        }
+    }
+
+    // Addresses one cluster from its own block, independently of the
+    // clusters addressed before it.
+    static Ipv4InterfaceContainer AssignAddresses(const ClusterInfo& cluster)
+    {
+        Ipv4AddressHelper addresses(cluster.network, "255.255.255.0");
+        return addresses.Assign(cluster.devices);
+    }
+
+    Ptr<PositionAllocator> CreatePositionAllocator() const
+    {
+        std::ostringstream range;
+        range << "ns3::UniformRandomVariable[Min=0.0|Max=" << m_config.fieldSize << "]";
+        ObjectFactory pos;
+        pos.SetTypeId("ns3::RandomRectanglePositionAllocator");
+        pos.Set("X", StringValue(range.str()));
+        pos.Set("Y", StringValue(range.str()));
+        return pos.Create()->GetObject<PositionAllocator>();
+    }
+
+    // Waypoints are drawn from alloc, initial positions from initial.
+    MobilityHelper CreateMobilityHelper(Ptr<PositionAllocator> alloc,
+                                        Ptr<PositionAllocator> initial) const
+    {
+        MobilityHelper mobility;
+        mobility.SetMobilityModel("ns3::RandomWaypointMobilityModel",
+                                  "Speed",
+                                  StringValue(WAYPOINT_SPEED),
+                                  "Pause",
+                                  StringValue(WAYPOINT_PAUSE),
+                                  "PositionAllocator",
+                                  PointerValue(alloc));
+        mobility.SetPositionAllocator(initial);
+        return mobility;
+    }
+
+    // What MobilityHelper does with a reference model pushed, but with a
+    // CoalescedHierarchicalMobilityModel around each random waypoint child.
+    // As there, the initial position drawn is the child's, relative to the
+    // gateway.
+    static void InstallCoalescedMobility(const NodeContainer& nodes,
+                                         Ptr<Node> gateway,
+                                         Ptr<PositionAllocator> alloc,
+                                         Ptr<PositionAllocator> initial)
+    {
+        ObjectFactory waypoint("ns3::RandomWaypointMobilityModel");
+        waypoint.Set("Speed", StringValue(WAYPOINT_SPEED));
+        waypoint.Set("Pause", StringValue(WAYPOINT_PAUSE));
+        waypoint.Set("PositionAllocator", PointerValue(alloc));
+        Ptr<MobilityModel> parent = gateway->GetObject<MobilityModel>();
+        for (uint32_t i = 0; i < nodes.GetN(); ++i)
+        {
+            Ptr<MobilityModel> child = waypoint.Create<MobilityModel>();
+            child->SetPosition(initial->GetNext());
+            Ptr<CoalescedHierarchicalMobilityModel> model =
+                CreateObject<CoalescedHierarchicalMobilityModel>();
+            model->SetChild(child);
+            model->SetParent(parent);
+            nodes.Get(i)->AggregateObject(model);
+        }
+    }
+
+    static constexpr const char* WAYPOINT_SPEED = "ns3::UniformRandomVariable[Min=0.0|Max=100.0]";
+    static constexpr const char* WAYPOINT_PAUSE = "ns3::ConstantRandomVariable[Constant=0.0]";
+
+    const ScenarioConfig& m_config;
+    const TopologySnapshot* m_snapshot;
+    std::vector<TierSpec> m_tiers;
+    std::vector<ClusterInfo> m_clusters;
+    NodeContainer m_leaves;
+};
+
+//
+// MAC level counters per tier, over the devices of the tier's clusters:
+// PPDUs put on the air by the PHY (control and management frames
+// included), the data MPDUs they carried and the MSDUs inside those, so
+// MpdusPerPpdu shows A-MPDU aggregation and MsdusPerMpdu A-MSDU
+// aggregation (retransmissions count again), data frames the rate manager
+// saw fail (each one a retry or a drop), frames dropped after the last
+// retry, and bytes every MAC passed up to the stack.  The last count takes
+// a broadcast once per receiver and forwarded data once per hop, so its
+// rate over the traffic period (MacRxKbps) is MAC load, not goodput; the
+// application goodput per tier is in tiers.csv.  Written to tier-mac.csv,
+// only with --macStats.
+//
+class TierMacStats
+{
+  public:
+    TierMacStats(const std::vector<ClusterInfo>& clusters, const std::vector<TierSpec>& tiers)
+        : m_tiers(tiers),
+          m_counters(tiers.size())
+    {
+        for (const ClusterInfo& cluster : clusters)
+        {
+            for (uint32_t i = 0; i < cluster.devices.GetN(); ++i)
+            {
+                Ptr<WifiNetDevice> device = DynamicCast<WifiNetDevice>(cluster.devices.Get(i));
+                Ptr<WifiRemoteStationManager> manager = device->GetRemoteStationManager();
+                manager->TraceConnectWithoutContext(
+                    "MacTxDataFailed",
+                    MakeCallback(&TierMacStats::NotifyDataFailed, this).Bind(cluster.tier));
+                manager->TraceConnectWithoutContext(
+                    "MacTxFinalDataFailed",
+                    MakeCallback(&TierMacStats::NotifyFinalDataFailed, this).Bind(cluster.tier));
+                device->GetPhy()->TraceConnectWithoutContext(
+                    "PhyTxPsduBegin",
+                    MakeCallback(&TierMacStats::NotifyTxBegin, this).Bind(cluster.tier));
+                device->GetMac()->TraceConnectWithoutContext(
+                    "MacRx",
+                    MakeCallback(&TierMacStats::NotifyRx, this).Bind(cluster.tier));
+            }
+        }
+    }
+
+    uint64_t GetRetries() const
+    {
+        uint64_t retries = 0;
+        for (const Counters& counters : m_counters)
+        {
+            retries += counters.dataFailed;
+        }
+        return retries;
+    }
+
+    uint64_t GetFinalFailures() const
+    {
+        uint64_t failures = 0;
+        for (const Counters& counters : m_counters)
+        {
+            failures += counters.finalDataFailed;
+        }
+        return failures;
+    }
+
+    void Write(const std::string& fileName, double activeTime) const
+    {
+        std::ofstream file(fileName);
+        file << "Tier;Standard;ChannelWidth;RateManager;DataMode;TxPpdus;TxMpdus;TxMsdus;"
+                "MpdusPerPpdu;MsdusPerMpdu;DataFailed;FinalDataFailed;RxBytes;MacRxKbps\n";
+        for (uint32_t tier = 0; tier < m_counters.size(); ++tier)
+        {
+            const TierSpec& spec = m_tiers[tier];
+            const Counters& c = m_counters[tier];
+            file << tier << ";" << spec.standard << ";" << spec.channelWidth << ";"
+                 << spec.rateManager << ";"
+                 << (spec.rateManager == "constant" ? spec.dataMode : "-") << ";" << c.txPpdus
+                 << ";" << c.txMpdus << ";" << c.txMsdus << ";"
+                 << (c.txPpdus > 0 ? double(c.txMpdus) / c.txPpdus : 0) << ";"
+                 << (c.txMpdus > 0 ? double(c.txMsdus) / c.txMpdus : 0) << ";" << c.dataFailed
+                 << ";" << c.finalDataFailed << ";" << c.rxBytes << ";"
+                 << (activeTime > 0 ? c.rxBytes * 8.0 / activeTime / 1000 : 0) << "\n";
+        }
+    }
+
+  private:
+    struct Counters
+    {
+        uint64_t txPpdus = 0;
+        uint64_t txMpdus = 0;
+        uint64_t txMsdus = 0;
+        uint64_t dataFailed = 0;
+        uint64_t finalDataFailed = 0;
+        uint64_t rxBytes = 0;
+    };
+
+    void NotifyDataFailed(uint32_t tier, Mac48Address)
+    {
+        ++m_counters[tier].dataFailed;
+    }
+
+    void NotifyFinalDataFailed(uint32_t tier, Mac48Address)
+    {
+        ++m_counters[tier].finalDataFailed;
+    }
+
+    void NotifyTxBegin(uint32_t tier, WifiConstPsduMap psdus, WifiTxVector, double)
+    {
+        Counters& counters = m_counters[tier];
+        ++counters.txPpdus;
+        for (const auto& psdu : psdus)
+        {
+            for (const auto& mpdu : *psdu.second)
+            {
+                if (!mpdu->GetHeader().IsData())
+                {
+                    continue;
+                }
+                ++counters.txMpdus;
+                counters.txMsdus +=
+                    mpdu->GetHeader().IsQosAmsdu() ? std::distance(mpdu->begin(), mpdu->end()) : 1;
+            }
+        }
+    }
+
+    void NotifyRx(uint32_t tier, Ptr<const Packet> packet)
+    {
+        m_counters[tier].rxBytes += packet->GetSize();
+    }
+
+    std::vector<TierSpec> m_tiers;
+    std::vector<Counters> m_counters;
+};
+
+//
+// Routing mode "oracle": shortest hop-count paths computed with full
+// knowledge of the topology and written as host routes into every node's
+// Ipv4StaticRouting, with no control traffic at all.  Two nodes are linked
+// when they share a cluster and, if oracleRange is set, are no further
+// apart than that range.  The link set is re-derived on course changes
+// (coalesced to one evaluation per instant) and, with a range, also every
+// oracleInterval since straight legs cross it too; routes are rewritten
+// only when the link set actually changed.
+//
+class OracleRouting
+{
+  public:
+    OracleRouting(const ScenarioConfig& config, const std::vector<ClusterInfo>& clusters)
+        : m_config(config),
+          m_clusters(clusters),
+          m_addresses(NodeList::GetNNodes()),
+          m_routes(NodeList::GetNNodes(), 0)
+    {
+        for (const ClusterInfo& cluster : m_clusters)
+        {
+            for (uint32_t i = 0; i < cluster.nodes.GetN(); ++i)
+            {
+                m_addresses[cluster.nodes.Get(i)->GetId()].push_back(cluster.interfaces.GetAddress(i));
+            }
+        }
+    }
+
+    void Start()
+    {
+        for (uint32_t n = 0; n < NodeList::GetNNodes(); ++n)
+        {
+            NodeList::GetNode(n)->GetObject<MobilityModel>()->TraceConnectWithoutContext(
+                "CourseChange",
+                MakeCallback(&OracleRouting::NotifyCourseChange, this));
+        }
+        Update();
+        if (m_config.oracleRange > 0)
+        {
+            Simulator::Schedule(Seconds(m_config.oracleInterval), &OracleRouting::Poll, this);
+        }
+    }
+
+    uint32_t GetRecomputations() const
+    {
+        return m_recomputations;
+    }
+
+  private:
+    struct Link
+    {
+        uint32_t neighbor;
+        uint32_t interface;
+        Ipv4Address address;
+    };
+
+    void NotifyCourseChange(Ptr<const MobilityModel>)
+    {
+        if (!m_pending.IsRunning())
+        {
+            m_pending = Simulator::ScheduleNow(&OracleRouting::Update, this);
+        }
+    }
+
+    void Poll()
+    {
+        Update();
+        Simulator::Schedule(Seconds(m_config.oracleInterval), &OracleRouting::Poll, this);
+    }
+
+    void Update()
+    {
+        std::vector<Vector> positions(NodeList::GetNNodes());
+        for (uint32_t n = 0; n < positions.size(); ++n)
+        {
+            positions[n] = NodeList::GetNode(n)->GetObject<MobilityModel>()->GetPosition();
+        }
+
+        // Edges as (node, neighbour, cluster index), in a fixed order
+        std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> edges;
+        for (uint32_t c = 0; c < m_clusters.size(); ++c)
+        {
+            const NodeContainer& nodes = m_clusters[c].nodes;
+            for (uint32_t i = 0; i < nodes.GetN(); ++i)
+            {
+                for (uint32_t j = i + 1; j < nodes.GetN(); ++j)
+                {
+                    uint32_t a = nodes.Get(i)->GetId();
+                    uint32_t b = nodes.Get(j)->GetId();
+                    if (m_config.oracleRange <= 0 ||
+                        CalculateDistance(positions[a], positions[b]) <= m_config.oracleRange)
+                    {
+                        edges.emplace_back(i, j, c);
+                    }
+                }
+            }
+        }
+        if (edges == m_edges && m_recomputations > 0)
+        {
+            return;
+        }
+        m_edges.swap(edges);
+        Recompute();
+    }
+
+    void Recompute()
+    {
+        ++m_recomputations;
+        std::vector<std::vector<Link>> links(NodeList::GetNNodes());
+        for (const auto& edge : m_edges)
+        {
+            const ClusterInfo& cluster = m_clusters[std::get<2>(edge)];
+            uint32_t i = std::get<0>(edge);
+            uint32_t j = std::get<1>(edge);
+            uint32_t a = cluster.nodes.Get(i)->GetId();
+            uint32_t b = cluster.nodes.Get(j)->GetId();
+            links[a].push_back({b, cluster.interfaces.Get(i).second, cluster.interfaces.GetAddress(j)});
+            links[b].push_back({a, cluster.interfaces.Get(j).second, cluster.interfaces.GetAddress(i)});
+        }
+
+        Ipv4StaticRoutingHelper helper;
+        std::vector<int32_t> firstHop(links.size());
+        std::vector<uint32_t> queue;
+        for (uint32_t source = 0; source < links.size(); ++source)
+        {
+            Ptr<Ipv4StaticRouting> routing =
+                helper.GetStaticRouting(NodeList::GetNode(source)->GetObject<Ipv4>());
+            // The oracle's routes follow the interface routes; drop the old set
+            for (; m_routes[source] > 0; --m_routes[source])
+            {
+                routing->RemoveRoute(routing->GetNRoutes() - 1);
+            }
+
+            // Breadth-first search remembering which link of the source
+            // each node was first reached through
+            std::fill(firstHop.begin(), firstHop.end(), -1);
+            queue.assign(1, source);
+            firstHop[source] = 0;
+            for (std::size_t head = 0; head < queue.size(); ++head)
+            {
+                uint32_t node = queue[head];
+                for (uint32_t l = 0; l < links[node].size(); ++l)
+                {
+                    uint32_t next = links[node][l].neighbor;
+                    if (firstHop[next] < 0)
+                    {
+                        firstHop[next] = node == source ? int32_t(l) : firstHop[node];
+                        queue.push_back(next);
+                    }
+                }
+            }
+
+            for (std::size_t q = 1; q < queue.size(); ++q)
+            {
+                const Link& hop = links[source][firstHop[queue[q]]];
+                for (const Ipv4Address& destination : m_addresses[queue[q]])
+                {
+                    routing->AddHostRouteTo(destination, hop.address, hop.interface);
+                    ++m_routes[source];
+                }
+            }
+        }
+    }
+
+    const ScenarioConfig& m_config;
+    const std::vector<ClusterInfo>& m_clusters;
+    std::vector<std::vector<Ipv4Address>> m_addresses;
+    std::vector<uint32_t> m_routes;
+    std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> m_edges;
+    EventId m_pending;
+    uint32_t m_recomputations = 0;
+};
+
+//
+// Routing control plane cost: packets and bytes (IP header included) sent
+// by any node to or from the routing protocols' UDP ports (OLSR 698, AODV
+// 654, DSDV 269).  The protocols relay their messages by sending them again
+// themselves, so locally originated packets (SendOutgoing, whose packet
+// starts with the UDP header) include the relayed copies.  Installed with
+// --controlStats or --profile.
+//
+class ControlPlaneCounter
+{
+  public:
+    ControlPlaneCounter()
+    {
+        Config::ConnectWithoutContext("/NodeList/*/$ns3::Ipv4L3Protocol/SendOutgoing",
+                                      MakeCallback(&ControlPlaneCounter::NotifySend, this));
+    }
+
+    uint64_t GetPackets() const
+    {
+        return m_packets;
+    }
+
+    uint64_t GetBytes() const
+    {
+        return m_bytes;
+    }
+
+  private:
+    static bool IsRoutingPort(uint16_t port)
+    {
+        return port == 698 || port == 654 || port == 269;
+    }
+
+    void NotifySend(const Ipv4Header& ip, Ptr<const Packet> packet, uint32_t)
+    {
+        UdpHeader udp;
+        if (ip.GetProtocol() != UdpL4Protocol::PROT_NUMBER || !packet->PeekHeader(udp))
+        {
+            return;
+        }
+        if (IsRoutingPort(udp.GetDestinationPort()) || IsRoutingPort(udp.GetSourcePort()))
+        {
+            ++m_packets;
+            m_bytes += packet->GetSize() + ip.GetSerializedSize();
+        }
+    }
+
+    uint64_t m_packets = 0;
+    uint64_t m_bytes = 0;
+};
+
+//
+// Event counts and CPU time per originating module, filled in by
+// ProfilingScheduler.
+//
+struct EventProfile
+{
+    enum Category
+    {
+        WIFI,
+        OLSR,
+        APPLICATION,
+        MOBILITY,
+        FLOW_MONITOR,
+        ANIMATION,
+        INTERNET,
+        OTHER,
+        N_CATEGORIES
+    };
+
+    static const char* GetName(uint32_t category)
+    {
+        static const char* const names[] = {"wifi",
+                                            "olsr",
+                                            "application",
+                                            "mobility",
+                                            "flow-monitor",
+                                            "animation",
+                                            "internet",
+                                            "other"};
+        return names[category];
+    }
+
+    uint64_t scheduled[N_CATEGORIES] = {};
+    uint64_t executed[N_CATEGORIES] = {};
+    double seconds[N_CATEGORIES] = {};
+
+    void Write(const std::string& fileName) const
+    {
+        double total = 0;
+        for (uint32_t c = 0; c < N_CATEGORIES; ++c)
+        {
+            total += seconds[c];
+        }
+        std::ofstream file(fileName);
+        file << "Category;Scheduled;Executed;CpuSeconds;CpuShare\n";
+        for (uint32_t c = 0; c < N_CATEGORIES; ++c)
+        {
+            file << GetName(c) << ";" << scheduled[c] << ";" << executed[c] << ";" << seconds[c]
+                 << ";" << (total > 0 ? seconds[c] / total : 0) << "\n";
+        }
+    }
+};
+
+static EventProfile g_eventProfile;
+
+//
+// Cost of the event queue operations and queue depth over simulated time,
+// filled in by ProfilingScheduler.  One depth sample is kept per
+// DEPTH_PERIOD with the depth at its first event and the largest depth
+// reached during the period before it.
+//
+struct SchedulerProfile
+{
+    enum Operation
+    {
+        INSERT,
+        REMOVE_NEXT,
+        REMOVE,
+        N_OPERATIONS
+    };
+
+    struct DepthSample
+    {
+        double time;
+        uint64_t depth;
+        uint64_t maxDepth;
+    };
+
+    static const char* GetName(uint32_t operation)
+    {
+        static const char* const names[] = {"insert", "removeNext", "remove"};
+        return names[operation];
+    }
+
+    static Time GetDepthPeriod()
+    {
+        return Seconds(1);
+    }
+
+    uint64_t count[N_OPERATIONS] = {};
+    double seconds[N_OPERATIONS] = {};
+    uint64_t depth = 0;
+    uint64_t maxDepth = 0;
+    uint64_t periodMaxDepth = 0;
+    Time nextSample;
+    std::vector<DepthSample> samples;
+
+    double GetMeanNs(uint32_t operation) const
+    {
+        return count[operation] > 0 ? seconds[operation] * 1e9 / count[operation] : 0;
+    }
+
+    // Called with the timestamp of every event leaving the queue
+    void RecordDepth(uint64_t ts)
+    {
+        Time now = TimeStep(ts);
+        if (now >= nextSample)
+        {
+            samples.push_back({now.GetSeconds(), depth, periodMaxDepth});
+            periodMaxDepth = depth;
+            while (nextSample <= now)
+            {
+                nextSample += GetDepthPeriod();
+            }
+        }
+    }
+
+    void Write(const std::string& scheduler, const std::string& fileName, const std::string& depthFileName) const
+    {
+        std::ofstream file(fileName);
+        file << "Scheduler;Operation;Count;MeanNs;CpuSeconds;MaxDepth\n";
+        for (uint32_t o = 0; o < N_OPERATIONS; ++o)
+        {
+            file << scheduler << ";" << GetName(o) << ";" << count[o] << ";" << GetMeanNs(o) << ";"
+                 << seconds[o] << ";" << maxDepth << "\n";
+        }
+        std::ofstream depthFile(depthFileName);
+        depthFile << "Time;Depth;MaxDepth\n";
+        for (const DepthSample& sample : samples)
+        {
+            depthFile << sample.time << ";" << sample.depth << ";" << sample.maxDepth << "\n";
+        }
+    }
+};
+
+static SchedulerProfile g_schedulerProfile;
+
+// TypeId name of a --scheduler value
+static std::string
+GetSchedulerTypeName(const std::string& scheduler)
+{
+    static const std::map<std::string, std::string> schedulers = {
+        {"map", "ns3::MapScheduler"},
+        {"heap", "ns3::HeapScheduler"},
+        {"calendar", "ns3::CalendarScheduler"},
+        {"list", "ns3::ListScheduler"},
+        {"priority-queue", "ns3::PriorityQueueScheduler"}};
+    auto it = schedulers.find(scheduler);
+    NS_ABORT_MSG_IF(it == schedulers.end(), "Unknown scheduler " << scheduler);
+    return it->second;
+}
+
+//
+// Size-class allocator behind the global operator new/delete, switched on
+// with --pooledAlloc.  ns-3 creates every Packet, buffer, tag, header,
+// socket address and EventImpl of the data path with new; requests of up
+// to MAX_SIZE bytes from the simulation thread are served from per-class
+// free lists carved out of one reserved mapping (CLASS_BYTES per class),
+// so the steady-state send/deliver cycle reuses blocks instead of going
+// through malloc.  Other threads, larger sizes and exhausted classes use
+// malloc.  Blocks freed on another thread are handed back through a
+// locked list.
+//
+class PoolAllocator
+{
+  public:
+    static const std::size_t GRANULE = 16;
+    static const std::size_t MAX_SIZE = 1024;
+    static const std::size_t CLASSES = MAX_SIZE / GRANULE;
+    static const std::size_t CLASS_BYTES = std::size_t(64) << 20;
+
+    // Pools allocations of the calling thread from now on
+    static void Enable()
+    {
+        if (!s_base)
+        {
+            void* base = mmap(nullptr,
+                              CLASSES * CLASS_BYTES,
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                              -1,
+                              0);
+            NS_ABORT_MSG_IF(base == MAP_FAILED, "Cannot reserve the allocation pool");
+            s_base = reinterpret_cast<uintptr_t>(base);
+            for (std::size_t c = 0; c < CLASSES; ++c)
+            {
+                s_next[c] = s_base + c * CLASS_BYTES;
+            }
+        }
+        s_owner = true;
+    }
+
+    static void* Allocate(std::size_t size)
+    {
+        if (s_owner && size <= MAX_SIZE)
+        {
+            std::size_t c = size == 0 ? 0 : (size - 1) / GRANULE;
+            ++s_allocations[c];
+            if (!s_free[c] && s_remotePending.load(std::memory_order_relaxed))
+            {
+                DrainRemote();
+            }
+            if (Block* block = s_free[c])
+            {
+                s_free[c] = block->next;
+                ++s_reused[c];
+                return block;
+            }
+            uintptr_t block = s_next[c];
+            if (block + (c + 1) * GRANULE <= s_base + (c + 1) * CLASS_BYTES)
+            {
+                s_next[c] = block + (c + 1) * GRANULE;
+                return reinterpret_cast<void*>(block);
+            }
+            ++s_fallbacks;
+        }
+        return std::malloc(size == 0 ? 1 : size);
+    }
+
+    static void Free(void* pointer)
+    {
+        uintptr_t address = reinterpret_cast<uintptr_t>(pointer);
+        if (!s_base || address < s_base || address >= s_base + CLASSES * CLASS_BYTES)
+        {
+            std::free(pointer);
+            return;
+        }
+        std::size_t c = (address - s_base) / CLASS_BYTES;
+        Block* block = static_cast<Block*>(pointer);
+        if (s_owner)
+        {
+            block->next = s_free[c];
+            s_free[c] = block;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(s_remoteMutex);
+        block->next = s_remote[c];
+        s_remote[c] = block;
+        s_remotePending.store(true, std::memory_order_relaxed);
+    }
+
+    // Allocations and free list hits per size class into fileName
+    static void Write(const std::string& fileName)
+    {
+        std::ofstream file(fileName);
+        file << "SizeClass;Allocations;Reused;HitRate\n";
+        uint64_t allocations = 0;
+        uint64_t reused = 0;
+        for (std::size_t c = 0; c < CLASSES; ++c)
+        {
+            if (s_allocations[c] > 0)
+            {
+                file << (c + 1) * GRANULE << ";" << s_allocations[c] << ";" << s_reused[c] << ";"
+                     << double(s_reused[c]) / s_allocations[c] << "\n";
+            }
+            allocations += s_allocations[c];
+            reused += s_reused[c];
+        }
+        file << "total;" << allocations << ";" << reused << ";"
+             << (allocations > 0 ? double(reused) / allocations : 0) << "\n";
+        file << "malloc-fallback;" << s_fallbacks << ";0;0\n";
+    }
+
+  private:
+    struct Block
+    {
+        Block* next;
+    };
+
+    static void DrainRemote()
+    {
+        std::lock_guard<std::mutex> lock(s_remoteMutex);
+        for (std::size_t c = 0; c < CLASSES; ++c)
+        {
+            while (Block* block = s_remote[c])
+            {
+                s_remote[c] = block->next;
+                block->next = s_free[c];
+                s_free[c] = block;
+            }
+        }
+        s_remotePending.store(false, std::memory_order_relaxed);
+    }
+
+    // All constant-initialized: operator new runs before static constructors
+    static uintptr_t s_base;
+    static uintptr_t s_next[CLASSES];
+    static Block* s_free[CLASSES];
+    static Block* s_remote[CLASSES];
+    static std::atomic<bool> s_remotePending;
+    static std::mutex s_remoteMutex;
+    static thread_local bool s_owner;
+    static uint64_t s_allocations[CLASSES];
+    static uint64_t s_reused[CLASSES];
+    static uint64_t s_fallbacks;
+};
+
+uintptr_t PoolAllocator::s_base = 0;
+uintptr_t PoolAllocator::s_next[PoolAllocator::CLASSES] = {};
+PoolAllocator::Block* PoolAllocator::s_free[PoolAllocator::CLASSES] = {};
+PoolAllocator::Block* PoolAllocator::s_remote[PoolAllocator::CLASSES] = {};
+std::atomic<bool> PoolAllocator::s_remotePending(false);
+std::mutex PoolAllocator::s_remoteMutex;
+thread_local bool PoolAllocator::s_owner = false;
+uint64_t PoolAllocator::s_allocations[PoolAllocator::CLASSES] = {};
+uint64_t PoolAllocator::s_reused[PoolAllocator::CLASSES] = {};
+uint64_t PoolAllocator::s_fallbacks = 0;
+
+void*
+operator new(std::size_t size)
+{
+    void* pointer = PoolAllocator::Allocate(size);
+    if (!pointer)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void*
+operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void*
+operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return PoolAllocator::Allocate(size);
+}
+
+void*
+operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return PoolAllocator::Allocate(size);
+}
+
+void
+operator delete(void* pointer) noexcept
+{
+    PoolAllocator::Free(pointer);
+}
+
+void
+operator delete[](void* pointer) noexcept
+{
+    PoolAllocator::Free(pointer);
+}
+
+void
+operator delete(void* pointer, std::size_t) noexcept
+{
+    PoolAllocator::Free(pointer);
+}
+
+void
+operator delete[](void* pointer, std::size_t) noexcept
+{
+    PoolAllocator::Free(pointer);
+}
+
+void
+operator delete(void* pointer, const std::nothrow_t&) noexcept
+{
+    PoolAllocator::Free(pointer);
+}
+
+void
+operator delete[](void* pointer, const std::nothrow_t&) noexcept
+{
+    PoolAllocator::Free(pointer);
+}
+
+//
+// Scheduler decorator feeding g_eventProfile.  An event is attributed to a
+// module from the dynamic type of its EventImpl: MakeEvent instantiations
+// are named after the bound class (olsr::RoutingProtocol,
+// OnOffApplication, ...), and the name is matched once per type.  The time
+// between two RemoveNext() calls is charged to the event removed by the
+// first one, which is the event the simulator ran in between.  Events are
+// queued in the Inner scheduler.
+//
+class ProfilingScheduler : public Scheduler
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid =
+            TypeId("ns3::ProfilingScheduler")
+                .SetParent<Scheduler>()
+                .SetGroupName("Core")
+                .AddConstructor<ProfilingScheduler>()
+                .AddAttribute("Inner",
+                              "Scheduler holding the events",
+                              TypeIdValue(MapScheduler::GetTypeId()),
+                              MakeTypeIdAccessor(&ProfilingScheduler::SetInner),
+                              MakeTypeIdChecker());
+        return tid;
+    }
+
+    void Insert(const Event& ev) override
+    {
+        ++g_eventProfile.scheduled[Classify(ev.impl)];
+        Clock::time_point start = Clock::now();
+        m_inner->Insert(ev);
+        Account(SchedulerProfile::INSERT, start);
+        SchedulerProfile& profile = g_schedulerProfile;
+        profile.maxDepth = std::max(profile.maxDepth, ++profile.depth);
+        profile.periodMaxDepth = std::max(profile.periodMaxDepth, profile.depth);
+    }
+
+    bool IsEmpty() const override
+    {
+        return m_inner->IsEmpty();
+    }
+
+    Event PeekNext() const override
+    {
+        return m_inner->PeekNext();
+    }
+
+    Event RemoveNext() override
+    {
+        Clock::time_point start = Clock::now();
+        Event ev = m_inner->RemoveNext();
+        Account(SchedulerProfile::REMOVE_NEXT, start);
+        --g_schedulerProfile.depth;
+        g_schedulerProfile.RecordDepth(ev.key.m_ts);
+        Charge();
+        m_running = Classify(ev.impl);
+        ++g_eventProfile.executed[m_running];
+        return ev;
+    }
+
+    void Remove(const Event& ev) override
+    {
+        Clock::time_point start = Clock::now();
+        m_inner->Remove(ev);
+        Account(SchedulerProfile::REMOVE, start);
+        --g_schedulerProfile.depth;
+    }
+
+    ProfilingScheduler()
+    {
+        s_current = this;
+    }
+
+    ~ProfilingScheduler() override
+    {
+        if (s_current == this)
+        {
+            s_current = nullptr;
+        }
+    }
+
+    // Charges the last executed event once Simulator::Run() has returned.
+    static void Finish()
+    {
+        if (s_current)
+        {
+            s_current->Charge();
+        }
+    }
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    // Charges the time since the last RemoveNext() to the event it removed.
+    void Charge()
+    {
+        Clock::time_point now = Clock::now();
+        if (m_running < EventProfile::N_CATEGORIES)
+        {
+            g_eventProfile.seconds[m_running] +=
+                std::chrono::duration<double>(now - m_started).count();
+        }
+        m_running = EventProfile::N_CATEGORIES;
+        m_started = now;
+    }
+
+    // Charges the time since start to a queue operation.
+    static void Account(SchedulerProfile::Operation operation, Clock::time_point start)
+    {
+        ++g_schedulerProfile.count[operation];
+        g_schedulerProfile.seconds[operation] += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    void SetInner(TypeId tid)
+    {
+        ObjectFactory factory;
+        factory.SetTypeId(tid);
+        m_inner = factory.Create<Scheduler>();
+    }
+
+    uint32_t Classify(EventImpl* impl)
+    {
+        std::type_index type(typeid(*impl));
+        auto it = m_categories.find(type);
+        if (it != m_categories.end())
+        {
+            return it->second;
+        }
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+        std::string name = status == 0 ? demangled : type.name();
+        std::free(demangled);
+        uint32_t category = Classify(name);
+        m_categories.emplace(type, category);
+        return category;
+    }
+
+    static uint32_t Classify(const std::string& name)
+    {
+        auto contains = [&name](const char* part) { return name.find(part) != std::string::npos; };
+        if (contains("AnimationInterface"))
+        {
+            return EventProfile::ANIMATION;
+        }
+        if (contains("FlowMonitor") || contains("FlowProbe") || contains("FlowSampler"))
+        {
+            return EventProfile::FLOW_MONITOR;
+        }
+        if (contains("olsr::"))
+        {
+            return EventProfile::OLSR;
+        }
+        if (contains("Mobility") || contains("Waypoint"))
+        {
+            return EventProfile::MOBILITY;
+        }
+        if (contains("Wifi") || contains("Yans") || contains("Txop") || contains("Phy") ||
+            contains("Mac") || contains("FrameExchange") || contains("ChannelAccess") ||
+            contains("Interference"))
+        {
+            return EventProfile::WIFI;
+        }
+        if (contains("OnOff") || contains("PacketSink") || contains("Application"))
+        {
+            return EventProfile::APPLICATION;
+        }
+        if (contains("Ipv4") || contains("Udp") || contains("Arp") || contains("TrafficControl") ||
+            contains("QueueDisc"))
+        {
+            return EventProfile::INTERNET;
+        }
+        return EventProfile::OTHER;
+    }
+
+    static ProfilingScheduler* s_current; // the simulator's scheduler, if profiling
+
+    Ptr<Scheduler> m_inner;
+    std::unordered_map<std::type_index, uint32_t> m_categories;
+    uint32_t m_running = EventProfile::N_CATEGORIES;
+    Clock::time_point m_started;
+};
+
+ProfilingScheduler* ProfilingScheduler::s_current = nullptr;
+
+NS_OBJECT_ENSURE_REGISTERED(ProfilingScheduler);
+
+//
+// Trace output with a byte budget.  Once the budget is spent further records
+// are dropped and counted, so a debug run cannot fill the disk.  A budget of
+// zero means unlimited.
+//
+struct BudgetedTraceFile : public SimpleRefCount<BudgetedTraceFile>
+{
+    std::string name;
+    uint64_t budget = 0;
+    uint64_t written = 0;
+    uint64_t dropped = 0;
+    Ptr<PcapFileWrapper> pcap;
+    std::ofstream ascii;
+
+    bool Reserve(uint64_t bytes)
+    {
+        if (budget > 0 && written + bytes > budget)
+        {
+            ++dropped;
+            return false;
+        }
+        written += bytes;
+        return true;
+    }
+};
+
+static void
+PcapTraceSink(Ptr<BudgetedTraceFile> file, Ptr<const Packet> packet)
+{
+    // 16 bytes of pcap record header precede every packet
+    if (file->Reserve(packet->GetSize() + 16))
+    {
+        file->pcap->Write(Simulator::Now(), packet);
+    }
+}
+
+static void
+PcapTxTraceSink(Ptr<BudgetedTraceFile> file, Ptr<const Packet> packet, double)
+{
+    PcapTraceSink(file, packet);
+}
+
+static void
+AsciiTraceRecord(Ptr<BudgetedTraceFile> file, char event, const std::string& context, Ptr<const Packet> packet)
+{
+    std::ostringstream line;
+    line << event << " " << Simulator::Now().GetSeconds() << " " << context << " " << *packet << "\n";
+    std::string record = line.str();
+    if (file->Reserve(record.size()))
+    {
+        file->ascii << record;
+    }
+}
+
+static void
+AsciiIpv4TxSink(Ptr<BudgetedTraceFile> file, std::string context, Ptr<const Packet> packet, Ptr<Ipv4>, uint32_t)
+{
+    AsciiTraceRecord(file, 't', context, packet);
+}
+
+static void
+AsciiIpv4RxSink(Ptr<BudgetedTraceFile> file, std::string context, Ptr<const Packet> packet, Ptr<Ipv4>, uint32_t)
+{
+    AsciiTraceRecord(file, 'r', context, packet);
+}
+
+static void
+AsciiIpv4DropSink(Ptr<BudgetedTraceFile> file,
+                  std::string context,
+                  const Ipv4Header& header,
+                  Ptr<const Packet> packet,
+                  Ipv4L3Protocol::DropReason,
+                  Ptr<Ipv4>,
+                  uint32_t)
+{
+    Ptr<Packet> copy = packet->Copy();
+    copy->AddHeader(header);
+    AsciiTraceRecord(file, 'd', context, copy);
+}
+
+//
+// Selective tracing.  The level is one of
+//   off     - no trace files at all,
+//   flows   - only the FlowMonitor XML export,
+//   cluster - flows plus IPv4 ascii and wifi pcap traces of the clusters
+//             listed in traceClusters (0 is the backbone, child clusters
+//             are numbered from 1 level by level),
+//   full    - flows plus ascii and pcap traces of every cluster.
+// traceNodes further restricts packet traces to the listed node ids, and
+// traceBudget caps the size in bytes of every trace file.
+//
+class TraceManager
+{
+  public:
+    enum Level
+    {
+        OFF,
+        FLOWS,
+        CLUSTER,
+        FULL
+    };
+
+    TraceManager(const ScenarioConfig& config, const std::string& outputDir)
+        : m_outputDir(outputDir),
+          m_budget(config.traceBudget),
+          m_nodes(ParseIdList(config.traceNodes)),
+          m_clusters(ParseIdList(config.traceClusters))
+    {
+        if (config.traceLevel == "off")
+        {
+            m_level = OFF;
+        }
+        else if (config.traceLevel == "flows")
+        {
+            m_level = FLOWS;
+        }
+        else if (config.traceLevel == "cluster")
+        {
+            m_level = CLUSTER;
+        }
+        else if (config.traceLevel == "full")
+        {
+            m_level = FULL;
+        }
+        else
+        {
+            NS_FATAL_ERROR("Unknown trace level " << config.traceLevel);
+        }
+    }
+
+    bool IsFlowStatsEnabled() const
+    {
+        return m_level >= FLOWS;
+    }
+
+    //
+    // Enables packet traces on the devices of one cluster, if the level and
+    // filters select it.  Nodes shared between clusters (the backbone
+    // routers) get their IPv4 trace connected only once.
+    //
+    void AddCluster(uint32_t cluster, const NetDeviceContainer& devices)
+    {
+        if (m_level < CLUSTER || (m_level == CLUSTER && m_clusters.count(cluster) == 0))
+        {
+            return;
+        }
+        for (uint32_t d = 0; d < devices.GetN(); ++d)
+        {
+            Ptr<NetDevice> device = devices.Get(d);
+            uint32_t nodeId = device->GetNode()->GetId();
+            if (!m_nodes.empty() && m_nodes.count(nodeId) == 0)
+            {
+                continue;
+            }
+            TraceWifiDevice(device);
+            if (m_ipv4Nodes.insert(nodeId).second)
+            {
+                TraceIpv4(nodeId);
+            }
+        }
+    }
+
+    void Report() const
+    {
+        for (const auto& file : m_files)
+        {
+            if (file->dropped > 0)
+            {
+                std::cout << "Trace budget exhausted for " << file->name << ": "
+                          << file->dropped << " records dropped" << std::endl;
+            }
+        }
+    }
+
+  private:
+    void TraceWifiDevice(Ptr<NetDevice> device)
+    {
+        Ptr<WifiNetDevice> wifiDevice = DynamicCast<WifiNetDevice>(device);
+        if (!wifiDevice)
+        {
+            return;
+        }
+        std::ostringstream name;
+        name << "mixed-wireless-" << device->GetNode()->GetId() << "-" << device->GetIfIndex()
+             << ".pcap";
+        Ptr<BudgetedTraceFile> file = Create<BudgetedTraceFile>();
+        file->name = SystemPath::Append(m_outputDir, name.str());
+        file->budget = m_budget;
+        PcapHelper pcapHelper;
+        file->pcap = pcapHelper.CreateFile(file->name, std::ios::out, PcapHelper::DLT_IEEE802_11);
+        file->Reserve(24); // pcap global header
+        Ptr<WifiPhy> phy = wifiDevice->GetPhy();
+        phy->TraceConnectWithoutContext("PhyTxBegin", MakeBoundCallback(&PcapTxTraceSink, file));
+        phy->TraceConnectWithoutContext("PhyRxEnd", MakeBoundCallback(&PcapTraceSink, file));
+        m_files.push_back(file);
+    }
+
+    void TraceIpv4(uint32_t nodeId)
+    {
+        if (!m_ascii)
+        {
+            m_ascii = Create<BudgetedTraceFile>();
+            m_ascii->name = SystemPath::Append(m_outputDir, "mixed-wireless.tr");
+            m_ascii->budget = m_budget;
+            m_ascii->ascii.open(m_ascii->name);
+            m_files.push_back(m_ascii);
+        }
+        std::ostringstream path;
+        path << "/NodeList/" << nodeId << "/$ns3::Ipv4L3Protocol/";
+        Config::Connect(path.str() + "Tx", MakeBoundCallback(&AsciiIpv4TxSink, m_ascii));
+        Config::Connect(path.str() + "Rx", MakeBoundCallback(&AsciiIpv4RxSink, m_ascii));
+        Config::Connect(path.str() + "Drop", MakeBoundCallback(&AsciiIpv4DropSink, m_ascii));
+    }
+
+    Level m_level;
+    std::string m_outputDir;
+    uint64_t m_budget;
+    std::set<uint32_t> m_nodes;
+    std::set<uint32_t> m_clusters;
+    std::set<uint32_t> m_ipv4Nodes;
+    Ptr<BudgetedTraceFile> m_ascii;
+    std::vector<Ptr<BudgetedTraceFile>> m_files;
+};
+
+//
+// Headline numbers of one replication.  They are written to summary.csv in
+// the replication directory and merged across replications by the batch
+// runner, so the order here is also the column order of the merged files.
+//
+typedef std::vector<std::pair<std::string, double>> ReplicationSummary;
+
+static void
+WriteSummary(const ReplicationSummary& summary, const std::string& fileName)
+{
+    std::ofstream file(fileName);
+    for (const auto& metric : summary)
+    {
+        file << metric.first << ";" << metric.second << "\n";
+    }
+}
+
+static bool
+ReadSummary(const std::string& fileName, ReplicationSummary& summary)
+{
+    std::ifstream file(fileName);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::string::size_type sep = line.find(';');
+        if (sep != std::string::npos)
+        {
+            summary.emplace_back(line.substr(0, sep), std::atof(line.c_str() + sep + 1));
+        }
+    }
+    return !summary.empty();
+}
+
+//
+// Two-sided 95% Student t critical value for the given degrees of freedom.
+//
+static double
+StudentT95(uint32_t dof)
+{
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+                                   2.262,  2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+                                   2.110,  2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+                                   2.060,  2.056, 2.052, 2.048, 2.045, 2.042};
+    if (dof == 0)
+    {
+        return 0;
+    }
+    return dof <= 30 ? table[dof - 1] : 1.960;
+}
+
+//
+// Application flow statistics kept up to date during the run in flat
+// arrays: per flow (by flow number), per node (by node id) and per cluster
+// (by cluster number).  Sources report through the OnOff Tx trace and
+// sinks through RxWithSeqTsSize, whose header carries the send time, so
+// nothing is looked up by five-tuple or address.  Delay and jitter
+// histograms have power-of-two microsecond bins: bin 0 holds values under
+// 1 us and bin b values under 2^b us, the last bin everything above.
+//
+class OnlineFlowStats
+{
+  public:
+    static const uint32_t BINS = 24;
+
+    struct FlowCounters
+    {
+        uint64_t txBytes = 0;
+        uint64_t rxBytes = 0;
+        uint32_t txPackets = 0;
+        uint32_t rxPackets = 0;
+        double delaySum = 0;
+        double jitterSum = 0;
+    };
+
+    struct Histogram
+    {
+        uint64_t bins[BINS] = {};
+
+        void Add(double seconds)
+        {
+            double us = seconds * 1e6;
+            uint32_t bin = us < 1 ? 0 : std::min<uint32_t>(BINS - 1, std::ilogb(us) + 1);
+            ++bins[bin];
+        }
+
+        // Upper bound (us) of the bin holding the q-quantile
+        uint64_t Percentile(double q) const
+        {
+            uint64_t total = 0;
+            for (uint32_t b = 0; b < BINS; ++b)
+            {
+                total += bins[b];
+            }
+            uint64_t seen = 0;
+            for (uint32_t b = 0; b < BINS; ++b)
+            {
+                seen += bins[b];
+                if (total > 0 && seen >= q * total)
+                {
+                    return uint64_t(1) << b;
+                }
+            }
+            return 0;
+        }
+    };
+
+    OnlineFlowStats(const std::vector<ClusterInfo>& clusters)
+        : m_clusterOf(NodeList::GetNNodes(), 0),
+          m_nodeTxBytes(NodeList::GetNNodes(), 0),
+          m_nodeRxBytes(NodeList::GetNNodes(), 0),
+          m_nodeTxPackets(NodeList::GetNNodes(), 0),
+          m_nodeRxPackets(NodeList::GetNNodes(), 0),
+          m_nodeDelaySum(NodeList::GetNNodes(), 0),
+          m_clusterDelay(clusters.size()),
+          m_clusterJitter(clusters.size())
+    {
+        for (uint32_t c = 0; c < clusters.size(); ++c)
+        {
+            uint32_t members = clusters[c].nodes.GetN() - (clusters[c].gateway ? 1 : 0);
+            for (uint32_t i = 0; i < members; ++i)
+            {
+                m_clusterOf[clusters[c].nodes.Get(i)->GetId()] = c;
+            }
+        }
+    }
+
+    // Follows one flow; both applications must have EnableSeqTsSizeHeader.
+    void AddFlow(Ptr<Node> source, Ptr<Node> destination, Ptr<Application> onoff, Ptr<Application> sink)
+    {
+        uint32_t flow = m_flows.size();
+        m_flows.emplace_back();
+        m_source.push_back(source->GetId());
+        m_destination.push_back(destination->GetId());
+        m_firstTx.push_back(-1);
+        m_lastTx.push_back(0);
+        m_lastDelay.push_back(0);
+        onoff->TraceConnectWithoutContext("Tx", MakeCallback(&OnlineFlowStats::NotifyTx, this).Bind(flow));
+        sink->TraceConnectWithoutContext("RxWithSeqTsSize",
+                                         MakeCallback(&OnlineFlowStats::NotifyRx, this).Bind(flow));
+    }
+
+    uint32_t GetNFlows() const
+    {
+        return m_flows.size();
+    }
+
+    const FlowCounters& GetFlow(uint32_t flow) const
+    {
+        return m_flows[flow];
+    }
+
+    uint32_t GetSource(uint32_t flow) const
+    {
+        return m_source[flow];
+    }
+
+    uint32_t GetDestination(uint32_t flow) const
+    {
+        return m_destination[flow];
+    }
+
+    // Times of the original run, -1 before the first packet
+    double GetFirstTx(uint32_t flow) const
+    {
+        return m_firstTx[flow];
+    }
+
+    double GetLastTx(uint32_t flow) const
+    {
+        return m_lastTx[flow];
+    }
+
+    // Cumulative counters for a checkpoint, one line per flow, node and cluster
+    void Save(std::ostream& out) const
+    {
+        out << "flows " << m_flows.size() << "\n";
+        for (uint32_t f = 0; f < m_flows.size(); ++f)
+        {
+            const FlowCounters& c = m_flows[f];
+            out << m_source[f] << " " << m_destination[f] << " " << c.txBytes << " " << c.rxBytes
+                << " " << c.txPackets << " " << c.rxPackets << " " << c.delaySum << " "
+                << c.jitterSum << " " << m_firstTx[f] << " " << m_lastTx[f] << " "
+                << m_lastDelay[f] << "\n";
+        }
+        out << "nodes " << m_nodeTxBytes.size() << "\n";
+        for (uint32_t n = 0; n < m_nodeTxBytes.size(); ++n)
+        {
+            out << m_nodeTxBytes[n] << " " << m_nodeRxBytes[n] << " " << m_nodeTxPackets[n] << " "
+                << m_nodeRxPackets[n] << " " << m_nodeDelaySum[n] << "\n";
+        }
+        out << "clusters " << m_clusterDelay.size() << "\n";
+        for (uint32_t c = 0; c < m_clusterDelay.size(); ++c)
+        {
+            for (uint32_t b = 0; b < BINS; ++b)
+            {
+                out << m_clusterDelay[c].bins[b] << " ";
+            }
+            for (uint32_t b = 0; b < BINS; ++b)
+            {
+                out << m_clusterJitter[c].bins[b] << (b + 1 < BINS ? " " : "\n");
+            }
+        }
+    }
+
+    //
+    // Counters saved by Save(), once the same flows have been added.  shift
+    // is the time of the original run at time 0 of this one.  Fails if the
+    // checkpoint holds other flows, nodes or clusters.
+    //
+    bool Restore(std::istream& in, double shift)
+    {
+        std::string section;
+        std::size_t count = 0;
+        if (!(in >> section >> count) || section != "flows" || count != m_flows.size())
+        {
+            return false;
+        }
+        for (uint32_t f = 0; f < m_flows.size(); ++f)
+        {
+            FlowCounters& c = m_flows[f];
+            uint32_t source = 0;
+            uint32_t destination = 0;
+            in >> source >> destination >> c.txBytes >> c.rxBytes >> c.txPackets >> c.rxPackets >>
+                c.delaySum >> c.jitterSum >> m_firstTx[f] >> m_lastTx[f] >> m_lastDelay[f];
+            if (source != m_source[f] || destination != m_destination[f])
+            {
+                return false;
+            }
+        }
+        if (!(in >> section >> count) || section != "nodes" || count != m_nodeTxBytes.size())
+        {
+            return false;
+        }
+        for (uint32_t n = 0; n < m_nodeTxBytes.size(); ++n)
+        {
+            in >> m_nodeTxBytes[n] >> m_nodeRxBytes[n] >> m_nodeTxPackets[n] >> m_nodeRxPackets[n] >>
+                m_nodeDelaySum[n];
+        }
+        if (!(in >> section >> count) || section != "clusters" || count != m_clusterDelay.size())
+        {
+            return false;
+        }
+        for (uint32_t c = 0; c < m_clusterDelay.size(); ++c)
+        {
+            for (uint32_t b = 0; b < BINS; ++b)
+            {
+                in >> m_clusterDelay[c].bins[b];
+            }
+            for (uint32_t b = 0; b < BINS; ++b)
+            {
+                in >> m_clusterJitter[c].bins[b];
+            }
+        }
+        m_shift = shift;
+        return bool(in);
+    }
+
+    //
+    // resumen.csv: per source node, the sum over its flows of the flow
+    // bitrate weighted by the share of the run it was active, which is
+    // txBytes * 8 / 1000 / lastTx, and the number of flows.
+    //
+    void WriteSourceSummary(const std::string& fileName) const
+    {
+        std::vector<double> traffic(m_nodeTxBytes.size(), 0);
+        std::vector<uint32_t> flows(m_nodeTxBytes.size(), 0);
+        for (uint32_t f = 0; f < m_flows.size(); ++f)
+        {
+            if (m_lastTx[f] > 0)
+            {
+                traffic[m_source[f]] += m_flows[f].txBytes * 8.0 / 1000 / m_lastTx[f];
+            }
+            ++flows[m_source[f]];
+        }
+
+        std::ofstream file(fileName);
+        file << "Source Address;average traffic\n";
+        for (uint32_t n = 0; n < flows.size(); ++n)
+        {
+            if (flows[n] > 0)
+            {
+                file << NodeList::GetNode(n)->GetObject<Ipv4>()->GetAddress(1, 0).GetLocal() << ";"
+                     << traffic[n] << ";" << flows[n] << "\n";
+            }
+        }
+    }
+
+    // Non-empty delay and jitter histogram bins per destination cluster
+    void WriteHistograms(const std::string& fileName) const
+    {
+        std::ofstream file(fileName);
+        file << "Cluster;Metric;UpperMicroseconds;Count\n";
+        for (uint32_t c = 0; c < m_clusterDelay.size(); ++c)
+        {
+            WriteHistogram(file, c, "delay", m_clusterDelay[c]);
+            WriteHistogram(file, c, "jitter", m_clusterJitter[c]);
+        }
+    }
+
+  private:
+    void NotifyTx(uint32_t flow, Ptr<const Packet> packet)
+    {
+        double now = Simulator::Now().GetSeconds() + m_shift;
+        FlowCounters& counters = m_flows[flow];
+        counters.txBytes += packet->GetSize();
+        ++counters.txPackets;
+        if (m_firstTx[flow] < 0)
+        {
+            m_firstTx[flow] = now;
+        }
+        m_lastTx[flow] = now;
+        uint32_t source = m_source[flow];
+        m_nodeTxBytes[source] += packet->GetSize();
+        ++m_nodeTxPackets[source];
+    }
+
+    void NotifyRx(uint32_t flow,
+                  Ptr<const Packet>,
+                  const Address&,
+                  const Address&,
+                  const SeqTsSizeHeader& header)
+    {
+        double delay = (Simulator::Now() - header.GetTs()).GetSeconds();
+        FlowCounters& counters = m_flows[flow];
+        uint32_t destination = m_destination[flow];
+        uint32_t cluster = m_clusterOf[destination];
+        // The sink has removed the SeqTsSizeHeader; its size field is the
+        // whole packet, as counted by the source's Tx trace
+        counters.rxBytes += header.GetSize();
+        counters.delaySum += delay;
+        if (counters.rxPackets > 0)
+        {
+            double jitter = std::abs(delay - m_lastDelay[flow]);
+            counters.jitterSum += jitter;
+            m_clusterJitter[cluster].Add(jitter);
+        }
+        ++counters.rxPackets;
+        m_lastDelay[flow] = delay;
+        m_nodeRxBytes[destination] += header.GetSize();
+        ++m_nodeRxPackets[destination];
+        m_nodeDelaySum[destination] += delay;
+        m_clusterDelay[cluster].Add(delay);
+    }
+
+    static void WriteHistogram(std::ofstream& file, uint32_t cluster, const char* metric, const Histogram& histogram)
+    {
+        for (uint32_t b = 0; b < BINS; ++b)
+        {
+            if (histogram.bins[b] > 0)
+            {
+                file << cluster << ";" << metric << ";" << (uint64_t(1) << b) << ";" << histogram.bins[b]
+                     << "\n";
+            }
+        }
+    }
+
+    std::vector<FlowCounters> m_flows;
+    std::vector<uint32_t> m_source;
+    std::vector<uint32_t> m_destination;
+    std::vector<double> m_firstTx;
+    std::vector<double> m_lastTx;
+    std::vector<double> m_lastDelay;
+    double m_shift = 0; // seconds of a resumed run's checkpoint, less its warm-up
+
+    std::vector<uint32_t> m_clusterOf; // own cluster of each node id
+    std::vector<uint64_t> m_nodeTxBytes;
+    std::vector<uint64_t> m_nodeRxBytes;
+    std::vector<uint32_t> m_nodeTxPackets;
+    std::vector<uint32_t> m_nodeRxPackets;
+    std::vector<double> m_nodeDelaySum;
+    std::vector<Histogram> m_clusterDelay;
+    std::vector<Histogram> m_clusterJitter;
+};
+
+//
+// Flow totals of summary.csv, from the application flows.  Their counters
+// are restored from a checkpoint, so a resumed replication reports the
+// whole run like one that ran through.  Packets sent but not received by
+// the end count as lost.  activeTime is the traffic period of the whole
+// run.
+//
+static ReplicationSummary
+SummarizeFlows(const OnlineFlowStats& online, double activeTime)
+{
+    uint64_t txPackets = 0;
+    uint64_t rxPackets = 0;
+    uint64_t rxBytes = 0;
+    uint64_t jitterSamples = 0;
+    double delaySum = 0;
+    double jitterSum = 0;
+    for (uint32_t f = 0; f < online.GetNFlows(); ++f)
+    {
+        const OnlineFlowStats::FlowCounters& flow = online.GetFlow(f);
+        txPackets += flow.txPackets;
+        rxPackets += flow.rxPackets;
+        rxBytes += flow.rxBytes;
+        delaySum += flow.delaySum;
+        jitterSum += flow.jitterSum;
+        jitterSamples += flow.rxPackets > 1 ? flow.rxPackets - 1 : 0;
+    }
+
+    ReplicationSummary summary;
+    summary.emplace_back("flows", online.GetNFlows());
+    summary.emplace_back("txPackets", txPackets);
+    summary.emplace_back("rxPackets", rxPackets);
+    summary.emplace_back("lostPackets", txPackets - std::min(txPackets, rxPackets));
+    summary.emplace_back("deliveryRatio", txPackets > 0 ? double(rxPackets) / txPackets : 0);
+    summary.emplace_back("meanDelay", rxPackets > 0 ? delaySum / rxPackets : 0);
+    summary.emplace_back("meanJitter", jitterSamples > 0 ? jitterSum / jitterSamples : 0);
+    summary.emplace_back("throughputKbps", activeTime > 0 ? rxBytes * 8.0 / activeTime / 1000 : 0);
+    return summary;
+}
+
+//
+// Time data frames wait in the MAC queues of the gateways (the nodes that
+// bridge a cluster to its parent) before their first transmission: start
+// of the first PSDU carrying the MPDU minus its enqueue timestamp.  The
+// queue's own Dequeue trace is no use here, since MPDUs stay queued until
+// acknowledged and it would add airtime, ACKs and retries.  Kept per
+// access category (from the TID) of QoS MACs and for the single DCF queue
+// of the others.  Means and histogram-based tail bounds go to
+// gateway-queues.csv, so runs with and without qos can be compared on the
+// same gateways.  Only built with --qos or --queueStats.
+//
+class GatewayQueueStats
+{
+  public:
+    GatewayQueueStats(const std::vector<ClusterInfo>& clusters)
+        : m_queues(N_QUEUES)
+    {
+        std::set<uint32_t> gateways;
+        for (const ClusterInfo& cluster : clusters)
+        {
+            if (cluster.gateway)
+            {
+                gateways.insert(cluster.gateway->GetId());
+            }
+        }
+        for (uint32_t id : gateways)
+        {
+            Ptr<Node> node = NodeList::GetNode(id);
+            for (uint32_t d = 0; d < node->GetNDevices(); ++d)
+            {
+                Ptr<WifiNetDevice> device = DynamicCast<WifiNetDevice>(node->GetDevice(d));
+                if (!device)
+                {
+                    continue;
+                }
+                device->GetPhy()->TraceConnectWithoutContext(
+                    "PhyTxPsduBegin",
+                    MakeCallback(&GatewayQueueStats::NotifyTxBegin, this));
+            }
+        }
+    }
+
+    void Write(const std::string& fileName) const
+    {
+        std::ofstream file(fileName);
+        file << "Queue;Transmitted;MeanDelay;P50UpperMicroseconds;P95UpperMicroseconds;P99UpperMicroseconds\n";
+        static const char* const names[N_QUEUES] = {"BE", "BK", "VI", "VO", "DCF"};
+        for (uint32_t q = 0; q < N_QUEUES; ++q)
+        {
+            const Queue& queue = m_queues[q];
+            file << names[q] << ";" << queue.transmitted << ";"
+                 << (queue.transmitted > 0 ? queue.delaySum / queue.transmitted : 0) << ";"
+                 << queue.delay.Percentile(0.50) << ";" << queue.delay.Percentile(0.95) << ";"
+                 << queue.delay.Percentile(0.99) << "\n";
+        }
+    }
+
+  private:
+    // Indices 0-3 follow AcIndex (BE, BK, VI, VO)
+    static const uint32_t DCF = 4;
+    static const uint32_t N_QUEUES = 5;
+
+    struct Queue
+    {
+        uint64_t transmitted = 0;
+        double delaySum = 0;
+        OnlineFlowStats::Histogram delay;
+    };
+
+    void NotifyTxBegin(WifiConstPsduMap psdus, WifiTxVector, double)
+    {
+        for (const auto& psdu : psdus)
+        {
+            for (const auto& mpdu : *psdu.second)
+            {
+                const WifiMacHeader& header = mpdu->GetHeader();
+                if (!header.IsData() || header.IsRetry())
+                {
+                    continue;
+                }
+                uint32_t queue = DCF;
+                if (header.IsQosData())
+                {
+                    queue = QosUtilsMapTidToAc(header.GetQosTid());
+                }
+                double delay = (Simulator::Now() - mpdu->GetTimestamp()).GetSeconds();
+                ++m_queues[queue].transmitted;
+                m_queues[queue].delaySum += delay;
+                m_queues[queue].delay.Add(delay);
+            }
+        }
+    }
+
+    std::vector<Queue> m_queues;
+};
+
+//
+// Per-hop latency by tier of unicast data frames: queueing (MAC accept to
+// the start of the transmission that got through, so backoff and failed
+// attempts included), airtime (that start to the receiver's MAC passing
+// the frame up) and forwarding (a relay's MAC passing it up to its next
+// MAC accepting it, i.e. IP and queue disc time, charged to the outgoing
+// tier).  Group addressed frames such as routing broadcasts, and A-MSDUs,
+// whose subframes do not keep their packet UIDs, are left out.  The times
+// are kept in a map by packet UID, which every copy of a packet shares,
+// until the packet is delivered or dropped.  Histograms summarized in
+// hops.csv.
+//
+class HopLatencyStats
+{
+  public:
+    HopLatencyStats(const std::vector<ClusterInfo>& clusters, uint32_t tiers)
+        : m_stages(tiers * N_STAGES)
+    {
+        for (const ClusterInfo& cluster : clusters)
+        {
+            for (uint32_t i = 0; i < cluster.devices.GetN(); ++i)
+            {
+                Ptr<WifiNetDevice> device = DynamicCast<WifiNetDevice>(cluster.devices.Get(i));
+                device->GetMac()->TraceConnectWithoutContext(
+                    "MacTx",
+                    MakeCallback(&HopLatencyStats::NotifyMacTx, this).Bind(cluster.tier));
+                device->GetMac()->TraceConnectWithoutContext(
+                    "MacRx",
+                    MakeCallback(&HopLatencyStats::NotifyMacRx, this).Bind(cluster.tier));
+                device->GetPhy()->TraceConnectWithoutContext(
+                    "PhyTxPsduBegin",
+                    MakeCallback(&HopLatencyStats::NotifyTxBegin, this));
+                device->GetMac()->TraceConnectWithoutContext(
+                    "DroppedMpdu",
+                    MakeCallback(&HopLatencyStats::NotifyMacDrop, this));
+            }
+        }
+        Config::ConnectWithoutContext("/NodeList/*/$ns3::Ipv4L3Protocol/LocalDeliver",
+                                      MakeCallback(&HopLatencyStats::NotifyDeliver, this));
+        Config::ConnectWithoutContext("/NodeList/*/$ns3::Ipv4L3Protocol/Drop",
+                                      MakeCallback(&HopLatencyStats::NotifyIpDrop, this));
+    }
+
+    void Write(const std::string& fileName) const
+    {
+        static const char* const names[N_STAGES] = {"queue", "air", "forward"};
+        std::ofstream file(fileName);
+        file << "Tier;Stage;Samples;MeanDelay;P50UpperMicroseconds;P95UpperMicroseconds;P99UpperMicroseconds\n";
+        for (uint32_t i = 0; i < m_stages.size(); ++i)
+        {
+            const Stage& stage = m_stages[i];
+            file << i / N_STAGES << ";" << names[i % N_STAGES] << ";" << stage.samples << ";"
+                 << (stage.samples > 0 ? stage.sum / stage.samples : 0) << ";"
+                 << stage.histogram.Percentile(0.50) << ";" << stage.histogram.Percentile(0.95) << ";"
+                 << stage.histogram.Percentile(0.99) << "\n";
+        }
+    }
+
+  private:
+    enum
+    {
+        QUEUE,
+        AIR,
+        FORWARD,
+        N_STAGES
+    };
+
+    struct Stage
+    {
+        uint64_t samples = 0;
+        double sum = 0;
+        OnlineFlowStats::Histogram histogram;
+    };
+
+    void Record(uint32_t tier, uint32_t stage, int64_t ns)
+    {
+        Stage& s = m_stages[tier * N_STAGES + stage];
+        ++s.samples;
+        s.sum += ns * 1e-9;
+        s.histogram.Add(ns * 1e-9);
+    }
+
+    // Times of the current hop, in ns; unset times are -1
+    struct Hop
+    {
+        int64_t macEnqueue = -1;
+        int64_t txStart = -1;
+        int64_t lastRx = -1; // kept until the relay hands it to its next MAC
+    };
+
+    void NotifyMacTx(uint32_t tier, Ptr<const Packet> packet)
+    {
+        int64_t now = Simulator::Now().GetNanoSeconds();
+        Hop& hop = m_hops[packet->GetUid()];
+        if (hop.lastRx >= 0)
+        {
+            Record(tier, FORWARD, now - hop.lastRx);
+        }
+        hop.macEnqueue = now;
+        hop.txStart = -1;
+        hop.lastRx = -1;
+    }
+
+    void NotifyTxBegin(WifiConstPsduMap psdus, WifiTxVector, double)
+    {
+        int64_t now = Simulator::Now().GetNanoSeconds();
+        for (const auto& psdu : psdus)
+        {
+            for (const auto& mpdu : *psdu.second)
+            {
+                const WifiMacHeader& header = mpdu->GetHeader();
+                if (!header.IsData())
+                {
+                    continue;
+                }
+                if (header.GetAddr1().IsGroup() || header.IsQosAmsdu())
+                {
+                    Forget(mpdu);
+                    continue;
+                }
+                auto it = m_hops.find(mpdu->GetPacket()->GetUid());
+                if (it != m_hops.end())
+                {
+                    it->second.txStart = now;
+                }
+            }
+        }
+    }
+
+    void NotifyMacRx(uint32_t tier, Ptr<const Packet> packet)
+    {
+        auto it = m_hops.find(packet->GetUid());
+        if (it == m_hops.end())
+        {
+            return;
+        }
+        int64_t now = Simulator::Now().GetNanoSeconds();
+        Hop& hop = it->second;
+        if (hop.macEnqueue >= 0 && hop.txStart >= hop.macEnqueue)
+        {
+            Record(tier, QUEUE, hop.txStart - hop.macEnqueue);
+            Record(tier, AIR, now - hop.txStart);
+        }
+        hop.macEnqueue = -1;
+        hop.txStart = -1;
+        hop.lastRx = now;
+    }
+
+    void NotifyMacDrop(WifiMacDropReason, Ptr<const WifiMpdu> mpdu)
+    {
+        Forget(mpdu);
+    }
+
+    void NotifyDeliver(const Ipv4Header&, Ptr<const Packet> packet, uint32_t)
+    {
+        m_hops.erase(packet->GetUid());
+    }
+
+    void NotifyIpDrop(const Ipv4Header&,
+                      Ptr<const Packet> packet,
+                      Ipv4L3Protocol::DropReason,
+                      Ptr<Ipv4>,
+                      uint32_t)
+    {
+        m_hops.erase(packet->GetUid());
+    }
+
+    // Drops the times of an MPDU, or of each MSDU of an A-MSDU
+    void Forget(Ptr<const WifiMpdu> mpdu)
+    {
+        if (!mpdu->GetHeader().IsQosAmsdu())
+        {
+            m_hops.erase(mpdu->GetPacket()->GetUid());
+            return;
+        }
+        for (const auto& msdu : *mpdu)
+        {
+            m_hops.erase(msdu.first->GetUid());
+        }
+    }
+
+    std::vector<Stage> m_stages; // tier * N_STAGES + stage
+    std::unordered_map<uint64_t, Hop> m_hops;
+};
+
+//
+// Traffic matrix: installs exactly one OnOff source and its matching
+// PacketSink per configured flow.  Endpoints are drawn according to the
+// selection policy:
+//   uniform - source and destination anywhere in the network,
+//   intra   - both ends inside the same child cluster,
+//   cross   - both ends in different child clusters,
+//   hotspot - every flow goes to the gateway of hotspotCluster.
+//
+class TrafficMatrix
+{
+  public:
+    // Stream of the endpoint selection; the network's streams follow it
+    static constexpr int64_t ENDPOINT_STREAM = 0;
+
+    TrafficMatrix(const ScenarioConfig& config, const std::vector<ClusterInfo>& clusters)
+        : m_config(config),
+          m_clusters(clusters),
+          m_nodes(NodeContainer::GetGlobal()),
+          m_random(CreateObject<UniformRandomVariable>())
+    {
+        m_random->SetStream(ENDPOINT_STREAM);
+        if (config.trafficPolicy == "hotspot")
+        {
+            NS_ABORT_MSG_IF(config.hotspotCluster == 0 || config.hotspotCluster >= clusters.size(),
+                            "hotspotCluster must name a child cluster");
+        }
+        else
+        {
+            NS_ABORT_MSG_IF(config.trafficPolicy != "uniform" && config.trafficPolicy != "intra" &&
+                                config.trafficPolicy != "cross",
+                            "Unknown traffic policy " << config.trafficPolicy);
+        }
+    }
+
+    // Sink ports are numbered from basePort up on each destination node
+    ApplicationContainer Install(uint16_t basePort, OnlineFlowStats& online)
+    {
+        ApplicationContainer apps;
+        std::vector<uint32_t> nextPort(NodeList::GetNNodes(), basePort);
+        for (uint32_t flow = 0; flow < m_config.maxapps; ++flow)
+        {
+            Ptr<Node> source;
+            Ptr<Node> destination;
+            SelectEndpoints(source, destination);
+            uint32_t& next = nextPort[destination->GetId()];
+            NS_ABORT_MSG_IF(next > 65535,
+                            "Node " << destination->GetId() << " has no sink port left for flow "
+                                    << flow);
+            uint16_t port = next++;
+            Ipv4Address sourceAddress = source->GetObject<Ipv4>()->GetAddress(1, 0).GetLocal();
+            Ipv4Address destinationAddress =
+                destination->GetObject<Ipv4>()->GetAddress(1, 0).GetLocal();
+
+            std::cout << "Node " << source->GetId() << " has address " << sourceAddress << " --> \t";
+            std::cout << "Node " << destination->GetId() << " has address " << destinationAddress
+                      << std::endl;
+
+            PacketSinkHelper sink("ns3::UdpSocketFactory",
+                                  InetSocketAddress(Ipv4Address::GetAny(), port));
+            sink.SetAttribute("EnableSeqTsSizeHeader", BooleanValue(true));
+            ApplicationContainer sinkApp = sink.Install(destination);
+            apps.Add(sinkApp);
+            m_endpoints.Add(source);
+            m_endpoints.Add(destination);
+
+            // The first latencyFlows flows are marked EF and ride AC_VI with qos
+            InetSocketAddress remote(destinationAddress, port);
+            if (flow < m_config.latencyFlows)
+            {
+                remote.SetTos(0xb8);
+            }
+            OnOffHelper onoff("ns3::UdpSocketFactory", remote);
+            onoff.SetAttribute("OnTime", StringValue("ns3::ConstantRandomVariable[Constant=1]"));
+            onoff.SetAttribute("OffTime", StringValue("ns3::ConstantRandomVariable[Constant=0]"));
+            onoff.SetAttribute("PacketSize", UintegerValue(m_config.packetSize));
+            onoff.SetAttribute("DataRate", StringValue(m_config.flowRate));
+            onoff.SetAttribute("EnableSeqTsSizeHeader", BooleanValue(true));
+            ApplicationContainer sourceApp = onoff.Install(source);
+            sourceApp.Start(Seconds(m_config.appStartTime));
+            sourceApp.Stop(Seconds(m_config.stopTime));
+            apps.Add(sourceApp);
+            online.AddFlow(source, destination, sourceApp.Get(0), sinkApp.Get(0));
+        }
+        return apps;
+    }
+
+    // Source and destination of every installed flow (with repeats)
+    const NodeContainer& GetEndpoints() const
+    {
+        return m_endpoints;
+    }
+
+  private:
+    Ptr<Node> Pick(const NodeContainer& nodes)
+    {
+        return nodes.Get(m_random->GetInteger(0, nodes.GetN() - 1));
+    }
+
+    // Two distinct nodes of the same container
+    void PickPair(const NodeContainer& nodes, Ptr<Node>& source, Ptr<Node>& destination)
+    {
+        source = Pick(nodes);
+        do
+        {
+            destination = Pick(nodes);
+        } while (destination == source && nodes.GetN() > 1);
+    }
+
+    void SelectEndpoints(Ptr<Node>& source, Ptr<Node>& destination)
+    {
+        uint32_t children = m_clusters.size() - 1;
+        if (m_config.trafficPolicy == "intra" && children > 0)
+        {
+            PickPair(m_clusters[1 + m_random->GetInteger(0, children - 1)].nodes,
+                     source,
+                     destination);
+        }
+        else if (m_config.trafficPolicy == "cross" && children > 1)
+        {
+            uint32_t from = m_random->GetInteger(0, children - 1);
+            uint32_t to = m_random->GetInteger(0, children - 2);
+            to += to >= from ? 1 : 0;
+            source = Pick(m_clusters[1 + from].nodes);
+            destination = Pick(m_clusters[1 + to].nodes);
+        }
+        else if (m_config.trafficPolicy == "hotspot")
+        {
+            destination = m_clusters[m_config.hotspotCluster].gateway;
+            do
+            {
+                source = Pick(m_nodes);
+            } while (source == destination && m_nodes.GetN() > 1);
+        }
+        else
+        {
+            PickPair(m_nodes, source, destination);
+        }
+    }
+
+    const ScenarioConfig& m_config;
+    const std::vector<ClusterInfo>& m_clusters;
+    NodeContainer m_nodes;
+    NodeContainer m_endpoints;
+    Ptr<UniformRandomVariable> m_random; // endpoint selection, stream ENDPOINT_STREAM
+};
+
+//
+// End-of-run flow statistics, held column by column and keyed on the raw
+// 32-bit IPv4 addresses.  WriteBinary() produces flows.bin: the magic
+// "MWFS", a format version, the flow and column counts, then for every
+// column its name, an element type ('u' uint32, 'U' uint64, 'd' double) and
+// the values of all flows.  WriteCsv() exports the same flows as data.csv.
+//
+// The per-flow duration, bitrate, active share, average traffic, delay and
+// jitter are derived once, a column at a time, by loops over contiguous
+// arrays that the compiler can vectorise.  Every division goes through
+// SafeDivide, so flows with no or a single received packet, or with a
+// single transmission instant, get 0 instead of inf/NaN.  The flows are
+// then summed per destination cluster (clusters.csv), per tier (tiers.csv)
+// and per source address (sources.csv).
+//
+class FlowStatsWriter
+{
+  public:
+    FlowStatsWriter(const FlowMonitor::FlowStatsContainer& stats,
+                    Ptr<Ipv4FlowClassifier> classifier)
+    {
+        for (const auto& flow : stats)
+        {
+            Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow(flow.first);
+            m_flowId.push_back(flow.first);
+            m_source.push_back(t.sourceAddress.Get());
+            m_destination.push_back(t.destinationAddress.Get());
+            m_ports.push_back(uint32_t(t.sourcePort) << 16 | t.destinationPort);
+            m_txBytes.push_back(flow.second.txBytes);
+            m_rxBytes.push_back(flow.second.rxBytes);
+            m_txPackets.push_back(flow.second.txPackets);
+            m_rxPackets.push_back(flow.second.rxPackets);
+            m_lostPackets.push_back(flow.second.lostPackets);
+            m_firstTx.push_back(flow.second.timeFirstTxPacket.GetSeconds());
+            m_lastTx.push_back(flow.second.timeLastTxPacket.GetSeconds());
+            m_delaySum.push_back(flow.second.delaySum.GetSeconds());
+            m_jitterSum.push_back(flow.second.jitterSum.GetSeconds());
+        }
+        Derive();
+    }
+
+    //
+    // The application flows instead, numbered from 1 with ports left 0.
+    // Used on resume, where FlowMonitor has only seen the last segment.
+    //
+    explicit FlowStatsWriter(const OnlineFlowStats& online)
+    {
+        for (uint32_t f = 0; f < online.GetNFlows(); ++f)
+        {
+            const OnlineFlowStats::FlowCounters& flow = online.GetFlow(f);
+            m_flowId.push_back(f + 1);
+            m_source.push_back(GetLocalAddress(online.GetSource(f)));
+            m_destination.push_back(GetLocalAddress(online.GetDestination(f)));
+            m_ports.push_back(0);
+            m_txBytes.push_back(flow.txBytes);
+            m_rxBytes.push_back(flow.rxBytes);
+            m_txPackets.push_back(flow.txPackets);
+            m_rxPackets.push_back(flow.rxPackets);
+            m_lostPackets.push_back(flow.txPackets - std::min(flow.txPackets, flow.rxPackets));
+            m_firstTx.push_back(std::max(0.0, online.GetFirstTx(f)));
+            m_lastTx.push_back(online.GetLastTx(f));
+            m_delaySum.push_back(flow.delaySum);
+            m_jitterSum.push_back(flow.jitterSum);
+        }
+        Derive();
+    }
+
+    void WriteBinary(const std::string& fileName) const
+    {
+        std::ofstream file(fileName, std::ios::binary);
+        const uint32_t version = 1;
+        const uint64_t flows = m_flowId.size();
+        const uint32_t columns = 13;
+        file.write("MWFS", 4);
+        file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        file.write(reinterpret_cast<const char*>(&flows), sizeof(flows));
+        file.write(reinterpret_cast<const char*>(&columns), sizeof(columns));
+        WriteColumn(file, "flowId", 'u', m_flowId);
+        WriteColumn(file, "source", 'u', m_source);
+        WriteColumn(file, "destination", 'u', m_destination);
+        WriteColumn(file, "ports", 'u', m_ports);
+        WriteColumn(file, "txBytes", 'U', m_txBytes);
+        WriteColumn(file, "rxBytes", 'U', m_rxBytes);
+        WriteColumn(file, "txPackets", 'u', m_txPackets);
+        WriteColumn(file, "rxPackets", 'u', m_rxPackets);
+        WriteColumn(file, "lostPackets", 'u', m_lostPackets);
+        WriteColumn(file, "firstTx", 'd', m_firstTx);
+        WriteColumn(file, "lastTx", 'd', m_lastTx);
+        WriteColumn(file, "delaySum", 'd', m_delaySum);
+        WriteColumn(file, "jitterSum", 'd', m_jitterSum);
+    }
+
+    void WriteCsv(const std::string& dataFileName) const
+    {
+        std::ofstream myfile(dataFileName);
+        myfile << "Source Address;Destination Address;TxBytes;RxBytes;FirstTxPacket;LastTxPacket;Duration;Delay;Jitter;LostPackets;TxBitrate;average traffic\n";
+
+        // Imprimir txBitrate de cada flujo
+        for (std::size_t i = 0; i < m_flowId.size(); ++i)
+        {
+            myfile << Ipv4Address(m_source[i]) << ";" << Ipv4Address(m_destination[i]) << ";"
+                   << m_txBytes[i] << ";" << m_rxBytes[i] << ";" << m_firstTx[i] << ";" << m_lastTx[i]
+                   << ";" << m_duration[i] << ";" << m_delay[i] << ";" << m_jitter[i] << ";"
+                   << m_lostPackets[i] << ";" << m_bitrate[i] << ";" << m_average[i] << "\n";
+        }
+    }
+
+    //
+    // clusters.csv and tiers.csv: the flows summed by the cluster of their
+    // destination address, and those sums by tier.  activeTime is the
+    // traffic period the goodput (kbit/s) is averaged over.  Flows to
+    // addresses outside the clusters are left out.
+    //
+    void WriteClusterSummaries(const std::vector<ClusterInfo>& clusters,
+                               double activeTime,
+                               const std::string& clusterFileName,
+                               const std::string& tierFileName) const
+    {
+        std::unordered_map<uint32_t, uint32_t> clusterOf;
+        uint32_t tiers = 0;
+        for (uint32_t c = 0; c < clusters.size(); ++c)
+        {
+            clusterOf[clusters[c].network.Get()] = c;
+            tiers = std::max(tiers, clusters[c].tier + 1);
+        }
+        std::vector<uint32_t> keys(m_flowId.size());
+        for (std::size_t i = 0; i < keys.size(); ++i)
+        {
+            auto it = clusterOf.find(m_destination[i] & 0xffffff00);
+            keys[i] = it != clusterOf.end() ? it->second : clusters.size();
+        }
+        Totals perCluster = Reduce(keys, clusters.size());
+
+        std::ofstream clusterFile(clusterFileName);
+        clusterFile << "Cluster;Tier;" << TOTALS_HEADER << "\n";
+        for (uint32_t c = 0; c < clusters.size(); ++c)
+        {
+            clusterFile << c << ";" << clusters[c].tier << ";";
+            WriteTotals(clusterFile, perCluster, c, activeTime);
+        }
+
+        std::vector<uint32_t> tierOf(clusters.size() + 1, tiers);
+        for (uint32_t c = 0; c < clusters.size(); ++c)
+        {
+            tierOf[c] = clusters[c].tier;
+        }
+        for (uint32_t& key : keys)
+        {
+            key = tierOf[key];
+        }
+        Totals perTier = Reduce(keys, tiers);
+        std::ofstream tierFile(tierFileName);
+        tierFile << "Tier;" << TOTALS_HEADER << "\n";
+        for (uint32_t t = 0; t < tiers; ++t)
+        {
+            tierFile << t << ";";
+            WriteTotals(tierFile, perTier, t, activeTime);
+        }
+    }
+
+    // sources.csv: the flows summed by source address, in address order
+    void WriteSourceSummaries(double activeTime, const std::string& fileName) const
+    {
+        std::vector<uint32_t> sources(m_source);
+        std::sort(sources.begin(), sources.end());
+        sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+        std::vector<uint32_t> keys(m_flowId.size());
+        for (std::size_t i = 0; i < keys.size(); ++i)
+        {
+            keys[i] = std::lower_bound(sources.begin(), sources.end(), m_source[i]) - sources.begin();
+        }
+        Totals perSource = Reduce(keys, sources.size());
+
+        std::ofstream file(fileName);
+        file << "Source Address;" << TOTALS_HEADER << "\n";
+        for (uint32_t s = 0; s < sources.size(); ++s)
+        {
+            file << Ipv4Address(sources[s]) << ";";
+            WriteTotals(file, perSource, s, activeTime);
+        }
+    }
+
+  private:
+    static constexpr const char* TOTALS_HEADER =
+        "Flows;TxPackets;RxPackets;LostPackets;RxBytes;Goodput;Delay;Jitter;DeliveryRatio;average traffic";
+
+    // Column sums of a group of flows
+    struct Totals
+    {
+        explicit Totals(std::size_t groups)
+            : flows(groups, 0),
+              txPackets(groups, 0),
+              rxPackets(groups, 0),
+              lostPackets(groups, 0),
+              rxBytes(groups, 0),
+              delaySum(groups, 0),
+              jitterSum(groups, 0),
+              jitterSamples(groups, 0),
+              average(groups, 0)
+        {
+        }
+
+        std::vector<uint32_t> flows;
+        std::vector<uint64_t> txPackets;
+        std::vector<uint64_t> rxPackets;
+        std::vector<uint64_t> lostPackets;
+        std::vector<uint64_t> rxBytes;
+        std::vector<double> delaySum;
+        std::vector<double> jitterSum;
+        std::vector<double> jitterSamples;
+        std::vector<double> average;
+    };
+
+    // First address of a node, the one TrafficMatrix sends to
+    static uint32_t GetLocalAddress(uint32_t node)
+    {
+        return NodeList::GetNode(node)->GetObject<Ipv4>()->GetAddress(1, 0).GetLocal().Get();
+    }
+
+    // num / den, or 0 where den is not positive.  Both operands are
+    // selected before dividing so the loops stay branch-free.
+    static double SafeDivide(double num, double den)
+    {
+        bool defined = den > 0;
+        return (defined ? num : 0.0) / (defined ? den : 1.0);
+    }
+
+    void Derive()
+    {
+        const std::size_t n = m_flowId.size();
+        m_duration.resize(n);
+        m_bitrate.resize(n);
+        m_share.resize(n);
+        m_average.resize(n);
+        m_delay.resize(n);
+        m_jitter.resize(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            m_duration[i] = m_lastTx[i] - m_firstTx[i];
+        }
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            m_bitrate[i] = SafeDivide(m_txBytes[i] * 8.0, m_duration[i]) / 1000;
+        }
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            m_share[i] = SafeDivide(m_duration[i], m_lastTx[i]);
+        }
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            m_average[i] = m_bitrate[i] * m_share[i];
+        }
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            m_delay[i] = SafeDivide(m_delaySum[i], m_rxPackets[i]);
+        }
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            m_jitter[i] = SafeDivide(m_jitterSum[i], double(m_rxPackets[i]) - 1);
+        }
+    }
+
+    // Sums the flows into groups by key; keys of groups or more are dropped
+    Totals Reduce(const std::vector<uint32_t>& keys, std::size_t groups) const
+    {
+        Totals totals(groups + 1);
+        for (std::size_t i = 0; i < keys.size(); ++i)
+        {
+            uint32_t g = std::min<std::size_t>(keys[i], groups);
+            ++totals.flows[g];
+            totals.txPackets[g] += m_txPackets[i];
+            totals.rxPackets[g] += m_rxPackets[i];
+            totals.lostPackets[g] += m_lostPackets[i];
+            totals.rxBytes[g] += m_rxBytes[i];
+            totals.delaySum[g] += m_delaySum[i];
+            totals.jitterSum[g] += m_jitterSum[i];
+            totals.jitterSamples[g] += m_rxPackets[i] > 1 ? m_rxPackets[i] - 1 : 0;
+            totals.average[g] += m_average[i];
+        }
+        return totals;
+    }
+
+    static void WriteTotals(std::ofstream& file, const Totals& totals, uint32_t g, double activeTime)
+    {
+        file << totals.flows[g] << ";" << totals.txPackets[g] << ";" << totals.rxPackets[g] << ";"
+             << totals.lostPackets[g] << ";" << totals.rxBytes[g] << ";"
+             << SafeDivide(totals.rxBytes[g] * 8.0, activeTime) / 1000 << ";"
+             << SafeDivide(totals.delaySum[g], totals.rxPackets[g]) << ";"
+             << SafeDivide(totals.jitterSum[g], totals.jitterSamples[g]) << ";"
+             << SafeDivide(totals.rxPackets[g], totals.txPackets[g]) << ";" << totals.average[g]
+             << "\n";
+    }
+
+    template <typename T>
+    static void WriteColumn(std::ofstream& file, const std::string& name, char type, const std::vector<T>& values)
+    {
+        const uint8_t length = name.size();
+        file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        file.write(name.data(), length);
+        file.write(&type, 1);
+        file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+
+    std::vector<uint32_t> m_flowId;
+    std::vector<uint32_t> m_source;
+    std::vector<uint32_t> m_destination;
+    std::vector<uint32_t> m_ports; // source port << 16 | destination port
+    std::vector<uint64_t> m_txBytes;
+    std::vector<uint64_t> m_rxBytes;
+    std::vector<uint32_t> m_txPackets;
+    std::vector<uint32_t> m_rxPackets;
+    std::vector<uint32_t> m_lostPackets;
+    std::vector<double> m_firstTx;
+    std::vector<double> m_lastTx;
+    std::vector<double> m_delaySum;
+    std::vector<double> m_jitterSum;
+
+    // Derived by Derive()
+    std::vector<double> m_duration;
+    std::vector<double> m_bitrate;
+    std::vector<double> m_share; // duration / lastTx
+    std::vector<double> m_average;
+    std::vector<double> m_delay;
+    std::vector<double> m_jitter;
+};
+
+//
+// Periodic flow statistics.  Every interval the change of each application
+// flow's OnlineFlowStats counters since the previous sample is copied into
+// a preallocated ring buffer, and a background thread drains the buffer
+// into samples.csv.  The simulation thread only waits when the buffer is
+// full.  Losses are only decided by FlowMonitor at the end of the run, so
+// samples have no loss column.
+//
+class FlowSampler
+{
+  public:
+    // With append the samples of a resumed run go after the existing ones
+    FlowSampler(const OnlineFlowStats& online,
+                Time interval,
+                uint32_t capacity,
+                const std::string& fileName,
+                bool append = false)
+        : m_online(online),
+          m_interval(interval),
+          m_previous(online.GetNFlows()),
+          m_ring(std::max(1u, capacity)),
+          m_fileName(fileName),
+          m_file(fileName, append ? std::ios::app : std::ios::out)
+    {
+        if (!append)
+        {
+            WriteHeader();
+        }
+    }
+
+    ~FlowSampler()
+    {
+        Stop();
+    }
+
+    void Start()
+    {
+        m_writer = std::thread(&FlowSampler::WriterLoop, this);
+        Simulator::Schedule(m_interval, &FlowSampler::TakeSample, this);
+    }
+
+    // Drains the buffer and stops the writer thread.
+    void Stop()
+    {
+        if (m_writer.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_notEmpty.notify_one();
+            m_writer.join();
+        }
+    }
+
+    //
+    // Checkpoint of the sampler: waits until every sample taken is on disk,
+    // then saves the file size and the counters of the last sample.
+    //
+    void Save(std::ostream& out)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_drained.wait(lock, [this] { return m_count == 0 && !m_writing; });
+        m_file.flush();
+        out << "samples " << uint64_t(m_file.tellp()) << " " << m_previous.size() << "\n";
+        for (const Counters& c : m_previous)
+        {
+            out << c.txBytes << " " << c.rxBytes << " " << c.txPackets << " " << c.rxPackets << " "
+                << c.delaySum << " " << c.jitterSum << "\n";
+        }
+    }
+
+    //
+    // Before Start(): cuts samples.csv back to the checkpoint, dropping what
+    // was sampled after it, and continues from its counters.  A checkpoint
+    // taken without sampler starts the file over.
+    //
+    bool Restore(std::istream& in, double shift)
+    {
+        std::string section;
+        uint64_t size = 0;
+        std::size_t count = 0;
+        if (!(in >> section >> size >> count) || section != "samples" ||
+            (count != 0 && count != m_previous.size()))
+        {
+            return false;
+        }
+        for (std::size_t flow = 0; flow < count; ++flow)
+        {
+            Counters& c = m_previous[flow];
+            in >> c.txBytes >> c.rxBytes >> c.txPackets >> c.rxPackets >> c.delaySum >> c.jitterSum;
+        }
+        m_file.close();
+        if (truncate(m_fileName.c_str(), count > 0 ? size : 0) != 0)
+        {
+            return false;
+        }
+        m_file.open(m_fileName, std::ios::app);
+        if (count == 0)
+        {
+            WriteHeader();
+        }
+        m_shift = shift;
+        return bool(in) && bool(m_file);
+    }
+
+  private:
+    typedef OnlineFlowStats::FlowCounters Counters;
+
+    struct Sample
+    {
+        double time;
+        uint32_t flow;
+        Counters delta;
+    };
+
+    void WriteHeader()
+    {
+        m_file << "Time;Flow;TxBytes;RxBytes;TxPackets;RxPackets;Delay;Jitter\n";
+    }
+
+    void TakeSample()
+    {
+        double now = Simulator::Now().GetSeconds() + m_shift;
+        for (uint32_t flow = 0; flow < m_online.GetNFlows(); ++flow)
+        {
+            const Counters& current = m_online.GetFlow(flow);
+            Counters& previous = m_previous[flow];
+            if (current.txPackets == previous.txPackets && current.rxPackets == previous.rxPackets)
+            {
+                continue;
+            }
+            Sample sample;
+            sample.time = now;
+            sample.flow = flow;
+            sample.delta.txBytes = current.txBytes - previous.txBytes;
+            sample.delta.rxBytes = current.rxBytes - previous.rxBytes;
+            sample.delta.txPackets = current.txPackets - previous.txPackets;
+            sample.delta.rxPackets = current.rxPackets - previous.rxPackets;
+            sample.delta.delaySum = current.delaySum - previous.delaySum;
+            sample.delta.jitterSum = current.jitterSum - previous.jitterSum;
+            previous = current;
+            Push(sample);
+        }
+        Simulator::Schedule(m_interval, &FlowSampler::TakeSample, this);
+    }
+
+    void Push(const Sample& sample)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this] { return m_count < m_ring.size(); });
+        m_ring[(m_head + m_count) % m_ring.size()] = sample;
+        ++m_count;
+        lock.unlock();
+        m_notEmpty.notify_one();
+    }
+
+    void WriterLoop()
+    {
+        std::vector<Sample> batch;
+        batch.reserve(m_ring.size());
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_notEmpty.wait(lock, [this] { return m_count > 0 || m_stopping; });
+                if (m_count == 0)
+                {
+                    break;
+                }
+                while (m_count > 0)
+                {
+                    batch.push_back(m_ring[m_head]);
+                    m_head = (m_head + 1) % m_ring.size();
+                    --m_count;
+                }
+                m_writing = true;
+            }
+            m_notFull.notify_one();
+            for (const Sample& sample : batch)
+            {
+                const Counters& d = sample.delta;
+                m_file << sample.time << ";" << sample.flow << ";" << d.txBytes << ";"
+                       << d.rxBytes << ";" << d.txPackets << ";" << d.rxPackets << ";"
+                       << (d.rxPackets > 0 ? d.delaySum / d.rxPackets : 0) << ";"
+                       << (d.rxPackets > 1 ? d.jitterSum / (d.rxPackets - 1) : 0) << "\n";
+            }
+            batch.clear();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_writing = false;
+            }
+            m_drained.notify_all();
+        }
+        m_file.flush();
+    }
+
+    const OnlineFlowStats& m_online;
+    Time m_interval;
+    std::vector<Counters> m_previous;
+    double m_shift = 0;
+
+    std::vector<Sample> m_ring;
+    std::size_t m_head = 0; // oldest unwritten sample
+    std::size_t m_count = 0;
+    bool m_stopping = false;
+    bool m_writing = false; // the writer holds a batch
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::condition_variable m_drained;
+    std::thread m_writer;
+    std::string m_fileName;
+    std::ofstream m_file;
+};
+
+//
+// Checkpoint file of a long run: the time reached, the topology with the
+// positions at that time, then the flow counters and sampler state in the
+// order OnlineFlowStats and FlowSampler save them.
+//
+struct CheckpointState
+{
+    // Seconds of OLSR convergence, with its fast intervals, before a
+    // resumed run restarts the sources (olsrWarmup when that is set)
+    static constexpr double RESUME_WARMUP = 2.0;
+
+    double time = 0;
+    TopologySnapshot topology;
+    std::stringstream state;
+
+    bool Load(const std::string& fileName)
+    {
+        std::ifstream file(fileName);
+        std::string magic;
+        std::string section;
+        uint32_t version = 0;
+        if (!(file >> magic >> version) || magic != "mixed-wireless-checkpoint" || version != 1 ||
+            !(file >> section >> time) || section != "time" || !topology.Read(file))
+        {
+            return false;
+        }
+        state << file.rdbuf();
+        return true;
+    }
+};
+
+//
+// Writes a checkpoint every interval until the end of the run.  Each one
+// goes to a temporary file first and is renamed over the last one, so a
+// job killed at any point leaves a complete checkpoint behind.
+//
+class Checkpointer
+{
+  public:
+    Checkpointer(const HierarchicalNetwork& network,
+                 const OnlineFlowStats& online,
+                 FlowSampler* sampler,
+                 double shift,
+                 const std::string& fileName)
+        : m_network(network),
+          m_online(online),
+          m_sampler(sampler),
+          m_shift(shift),
+          m_fileName(fileName)
+    {
+    }
+
+    void Start(Time interval, Time stop)
+    {
+        m_interval = interval;
+        m_stop = stop;
+        if (m_interval < m_stop)
+        {
+            Simulator::Schedule(m_interval, &Checkpointer::Write, this);
+        }
+    }
+
+  private:
+    void Write()
+    {
+        std::string temporary = m_fileName + ".tmp";
+        bool written = false;
+        {
+            std::ofstream file(temporary);
+            file << std::setprecision(17) << "mixed-wireless-checkpoint 1\n";
+            file << "time " << Simulator::Now().GetSeconds() + m_shift << "\n";
+            m_network.GetSnapshot().Write(file);
+            m_online.Save(file);
+            if (m_sampler)
+            {
+                m_sampler->Save(file);
+            }
+            else
+            {
+                file << "samples 0 0\n";
+            }
+            file.flush();
+            written = bool(file);
+        }
+        if (!written || std::rename(temporary.c_str(), m_fileName.c_str()) != 0)
+        {
+            NS_LOG_WARN("Cannot write checkpoint " << m_fileName);
+        }
+        if (Simulator::Now() + m_interval < m_stop)
+        {
+            Simulator::Schedule(m_interval, &Checkpointer::Write, this);
+        }
+    }
+
+    const HierarchicalNetwork& m_network;
+    const OnlineFlowStats& m_online;
+    FlowSampler* m_sampler;
+    double m_shift;
+    std::string m_fileName;
+    Time m_interval;
+    Time m_stop;
+};
+
+//
+// Early termination on converged statistics.  From appStartTime on, every
+// convergenceInterval the aggregate goodput (received bits per second over
+// all flows) and mean delay of the batch are added to running means and
+// variances (Welford).  Once at least convergenceMinBatches batches are in
+// and the 95% confidence interval half-width of both is below convergence
+// times their mean, the simulation is stopped.  The batches go to
+// convergence.csv.
+//
+class ConvergenceMonitor
+{
+  public:
+    ConvergenceMonitor(const OnlineFlowStats& online,
+                       const ScenarioConfig& config,
+                       double shift,
+                       const std::string& fileName)
+        : m_online(online),
+          m_config(config),
+          m_shift(shift),
+          m_file(fileName)
+    {
+        m_file << "Time;Goodput;Delay;GoodputHalfWidth;DelayHalfWidth\n";
+    }
+
+    void Start()
+    {
+        Simulator::Schedule(Seconds(m_config.appStartTime), &ConvergenceMonitor::Batch, this);
+    }
+
+    bool HasConverged() const
+    {
+        return m_converged;
+    }
+
+    uint64_t GetBatches() const
+    {
+        return m_goodput.n;
+    }
+
+  private:
+    struct RunningStat
+    {
+        uint64_t n = 0;
+        double mean = 0;
+        double m2 = 0;
+
+        void Add(double value)
+        {
+            ++n;
+            double delta = value - mean;
+            mean += delta / n;
+            m2 += delta * (value - mean);
+        }
+
+        double GetHalfWidth() const
+        {
+            return n > 1 ? StudentT95(n - 1) * std::sqrt(m2 / (n - 1) / n) : 0;
+        }
+
+        bool IsNarrow(double relative, uint64_t minimum) const
+        {
+            return n >= minimum && GetHalfWidth() < relative * std::abs(mean);
+        }
+    };
+
+    void Batch()
+    {
+        uint64_t rxBytes = 0;
+        uint64_t rxPackets = 0;
+        double delaySum = 0;
+        for (uint32_t flow = 0; flow < m_online.GetNFlows(); ++flow)
+        {
+            const OnlineFlowStats::FlowCounters& counters = m_online.GetFlow(flow);
+            rxBytes += counters.rxBytes;
+            rxPackets += counters.rxPackets;
+            delaySum += counters.delaySum;
+        }
+        if (m_started)
+        {
+            m_goodput.Add((rxBytes - m_rxBytes) * 8.0 / m_config.convergenceInterval);
+            if (rxPackets > m_rxPackets)
+            {
+                m_delay.Add((delaySum - m_delaySum) / (rxPackets - m_rxPackets));
+            }
+            m_file << Simulator::Now().GetSeconds() + m_shift << ";" << m_goodput.mean << ";"
+                   << m_delay.mean << ";" << m_goodput.GetHalfWidth() << ";"
+                   << m_delay.GetHalfWidth() << "\n";
+            if (m_goodput.IsNarrow(m_config.convergence, m_config.convergenceMinBatches) &&
+                m_delay.IsNarrow(m_config.convergence, m_config.convergenceMinBatches))
+            {
+                NS_LOG_INFO("Statistics converged after " << m_goodput.n << " batches");
+                m_converged = true;
+                Simulator::Stop();
+                return;
+            }
+        }
+        m_started = true;
+        m_rxBytes = rxBytes;
+        m_rxPackets = rxPackets;
+        m_delaySum = delaySum;
+        Simulator::Schedule(Seconds(m_config.convergenceInterval), &ConvergenceMonitor::Batch, this);
+    }
+
+    const OnlineFlowStats& m_online;
+    const ScenarioConfig& m_config;
+    double m_shift;
+    std::ofstream m_file;
+    bool m_started = false;
+    bool m_converged = false;
+    uint64_t m_rxBytes = 0;
+    uint64_t m_rxPackets = 0;
+    double m_delaySum = 0;
+    RunningStat m_goodput;
+    RunningStat m_delay;
+};
+
+//
+// Live progress of a run, rewritten every metricsInterval seconds of wall
+// clock as metrics.json or, for a Prometheus textfile collector,
+// metrics.prom: simulated time, events and events per wall second,
+// event queue depth (with --profile), flows active since the last update,
+// goodput since the last update and RSS.  The simulation thread copies its
+// counters into a snapshot every POLL of simulated time; a writer thread
+// publishes it, so a stalled run shows as simulated time standing still
+// while the wall clock and age keep moving.  Files are written next to
+// their name and renamed over it.
+//
+class MetricsExporter
+{
+  public:
+    static Time GetPollPeriod()
+    {
+        return MilliSeconds(100);
+    }
+
+    MetricsExporter(const OnlineFlowStats& online,
+                    const ScenarioConfig& config,
+                    double shift,
+                    const std::string& outputDir)
+        : m_online(online),
+          m_config(config),
+          m_shift(shift),
+          m_lastTx(online.GetNFlows(), 0),
+          m_sentIn(online.GetNFlows(), 0)
+    {
+        NS_ABORT_MSG_IF(config.metrics != "json" && config.metrics != "prometheus",
+                        "Unknown metrics format " << config.metrics);
+        m_fileName = SystemPath::Append(outputDir, config.metrics == "json" ? "metrics.json" : "metrics.prom");
+    }
+
+    ~MetricsExporter()
+    {
+        Stop();
+    }
+
+    void Start()
+    {
+        m_started = Clock::now();
+        Poll();
+        m_writer = std::thread(&MetricsExporter::WriterLoop, this);
+    }
+
+    // Publishes the final state and stops the writer thread.
+    void Stop()
+    {
+        if (m_writer.joinable())
+        {
+            Update();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_snapshot.done = true;
+                m_stopping = true;
+            }
+            m_wake.notify_one();
+            m_writer.join();
+        }
+    }
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Snapshot
+    {
+        double simTime = 0;
+        uint64_t events = 0;
+        int64_t queueDepth = -1; // unknown without the profiling scheduler
+        uint32_t activeFlows = 0;
+        uint64_t rxBytes = 0;
+        Clock::time_point taken;
+        bool done = false;
+    };
+
+    void Poll()
+    {
+        Update();
+        Simulator::Schedule(GetPollPeriod(), &MetricsExporter::Poll, this);
+    }
+
+    // Copies the simulation's counters into m_snapshot.
+    void Update()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Snapshot& snapshot = m_snapshot;
+        snapshot.simTime = Simulator::Now().GetSeconds() + m_shift;
+        snapshot.events = Simulator::GetEventCount();
+        if (m_config.profileEvents)
+        {
+            snapshot.queueDepth = g_schedulerProfile.depth;
+        }
+        snapshot.rxBytes = 0;
+        snapshot.activeFlows = 0;
+        for (uint32_t flow = 0; flow < m_online.GetNFlows(); ++flow)
+        {
+            const OnlineFlowStats::FlowCounters& counters = m_online.GetFlow(flow);
+            snapshot.rxBytes += counters.rxBytes;
+            if (counters.txPackets != m_lastTx[flow])
+            {
+                m_lastTx[flow] = counters.txPackets;
+                m_sentIn[flow] = m_publication;
+            }
+            snapshot.activeFlows += m_sentIn[flow] == m_publication ? 1 : 0;
+        }
+        snapshot.taken = Clock::now();
+    }
+
+    void WriterLoop()
+    {
+        Snapshot previous;
+        previous.taken = m_started;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_wake.wait_for(lock,
+                            std::chrono::duration<double>(m_config.metricsInterval),
+                            [this] { return m_stopping; });
+            Snapshot current = m_snapshot;
+            ++m_publication;
+            bool stopping = m_stopping;
+            lock.unlock();
+            Publish(previous, current);
+            previous = current;
+            lock.lock();
+            if (stopping)
+            {
+                break;
+            }
+        }
+    }
+
+    void Publish(const Snapshot& previous, const Snapshot& current) const
+    {
+        Clock::time_point now = Clock::now();
+        double wallSeconds = std::chrono::duration<double>(now - m_started).count();
+        double age = std::chrono::duration<double>(now - current.taken).count();
+        double wallDelta = std::chrono::duration<double>(current.taken - previous.taken).count();
+        double simDelta = current.simTime - previous.simTime;
+        double eventsPerSecond = wallDelta > 0 ? (current.events - previous.events) / wallDelta : 0;
+        double goodput = simDelta > 0 ? (current.rxBytes - previous.rxBytes) * 8.0 / simDelta : 0;
+
+        std::string temporary = m_fileName + ".tmp";
+        {
+            std::ofstream file(temporary);
+            if (m_config.metrics == "json")
+            {
+                file << "{\"run\": " << m_config.run << ", \"simTime\": " << current.simTime
+                     << ", \"stopTime\": " << m_config.stopTime + m_shift
+                     << ", \"wallSeconds\": " << wallSeconds << ", \"ageSeconds\": " << age
+                     << ", \"events\": " << current.events << ", \"eventsPerSecond\": " << eventsPerSecond;
+                if (current.queueDepth >= 0)
+                {
+                    file << ", \"queueDepth\": " << current.queueDepth;
+                }
+                file << ", \"flows\": " << m_online.GetNFlows() << ", \"activeFlows\": " << current.activeFlows
+                     << ", \"goodput\": " << goodput << ", \"rssBytes\": " << GetRssBytes()
+                     << ", \"done\": " << (current.done ? "true" : "false") << "}\n";
+            }
+            else
+            {
+                auto gauge = [&file, this](const char* name, const char* help, double value) {
+                    file << "# HELP mixed_wireless_" << name << " " << help << "\n"
+                         << "# TYPE mixed_wireless_" << name << " gauge\n"
+                         << "mixed_wireless_" << name << "{run=\"" << m_config.run << "\"} " << value
+                         << "\n";
+                };
+                gauge("sim_time_seconds", "Simulated time reached", current.simTime);
+                gauge("stop_time_seconds", "Simulated time the run stops at", m_config.stopTime + m_shift);
+                gauge("wall_seconds", "Wall-clock time since the run started", wallSeconds);
+                gauge("age_seconds", "Wall-clock age of these values", age);
+                gauge("events", "Events executed", current.events);
+                gauge("events_per_second", "Events per second of wall-clock time", eventsPerSecond);
+                if (current.queueDepth >= 0)
+                {
+                    gauge("queue_depth", "Events pending in the scheduler", current.queueDepth);
+                }
+                gauge("flows", "Flows installed", m_online.GetNFlows());
+                gauge("active_flows", "Flows that sent since the last update", current.activeFlows);
+                gauge("goodput_bps", "Received bits per simulated second since the last update", goodput);
+                gauge("rss_bytes", "Resident set size", GetRssBytes());
+                gauge("done", "1 once the simulation has finished", current.done ? 1 : 0);
+            }
+        }
+        std::rename(temporary.c_str(), m_fileName.c_str());
+    }
+
+    // Resident pages from /proc/self/statm, in bytes (0 where unavailable)
+    static double GetRssBytes()
+    {
+        std::ifstream statm("/proc/self/statm");
+        uint64_t size = 0;
+        uint64_t resident = 0;
+        if (!(statm >> size >> resident))
+        {
+            return 0;
+        }
+        return double(resident) * sysconf(_SC_PAGESIZE);
+    }
+
+    const OnlineFlowStats& m_online;
+    const ScenarioConfig& m_config;
+    double m_shift;
+    std::string m_fileName;
+    std::vector<uint32_t> m_lastTx; // txPackets of each flow at the last poll
+    Clock::time_point m_started;
+
+    Snapshot m_snapshot;
+    std::vector<uint64_t> m_sentIn; // publication during which each flow last sent
+    uint64_t m_publication = 1;     // the one being collected
+    bool m_stopping = false;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::thread m_writer;
+};
+
+//
+// Compresses a file that a library writes by name.  The name is replaced by
+// a FIFO read by a gzip process that writes name.gz, so the data is
+// compressed as it is produced, on another core, and never lands on disk
+// uncompressed.
+//
+class GzipPipe
+{
+  public:
+    explicit GzipPipe(const std::string& fileName)
+        : m_fileName(fileName)
+    {
+        unlink(fileName.c_str());
+        NS_ABORT_MSG_IF(mkfifo(fileName.c_str(), 0644) != 0, "Cannot create FIFO " << fileName);
+        std::cout.flush();
+        m_pid = fork();
+        NS_ABORT_MSG_IF(m_pid < 0, "fork() failed for gzip of " << fileName);
+        if (m_pid == 0)
+        {
+            int in = open(fileName.c_str(), O_RDONLY);
+            int out = open((fileName + ".gz").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (in < 0 || out < 0 || dup2(in, 0) < 0 || dup2(out, 1) < 0)
+            {
+                _exit(1);
+            }
+            execlp("gzip", "gzip", "-c", static_cast<char*>(nullptr));
+            _exit(127);
+        }
+    }
+
+    // Waits for gzip to finish.  Must run after the writer closed the file;
+    // a writer that never opened it is stood in for so that gzip sees EOF.
+    ~GzipPipe()
+    {
+        int fd = open(m_fileName.c_str(), O_WRONLY | O_NONBLOCK);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        waitpid(m_pid, nullptr, 0);
+        unlink(m_fileName.c_str());
+    }
+
+  private:
+    std::string m_fileName;
+    pid_t m_pid;
+};
+
+//
+// NetAnim output, only built when animation is requested.  Recording is
+// limited to [animStart, animStop] (animStop 0 means stopTime), route
+// tracking to the animNodes subset when one is given, and packet records
+// are skipped with animPackets=false.  With animCompress the XML files
+// are streamed through gzip.
+//
+class AnimationRecorder
 {
   public:
-    NodeContainer backbone;
-    NetDeviceContainer backboneDevices;
-    WifiHelper wifi;
-    WifiMacHelper mac;
-    YansWifiPhyHelper wifiPhy;
-    YansWifiChannelHelper wifiChannel;
-    OlsrHelper olsr;
-    InternetStackHelper internet;
-    MobilityHelper mobility;
-    ObjectFactory pos;
-    Ipv4InterfaceContainer interfaces;
+    AnimationRecorder(const ScenarioConfig& config, const std::string& outputDir)
+    {
+        std::string xml = SystemPath::Append(outputDir, "mixed-wireless.xml");
+        std::string routes = SystemPath::Append(outputDir, "mixed-wireless-route-tracking.xml");
+        if (config.animCompress)
+        {
+            m_pipes.emplace_back(new GzipPipe(xml));
+            m_pipes.emplace_back(new GzipPipe(routes));
+        }
+
+        Time start = Seconds(config.animStart);
+        Time stop = Seconds(config.animStop > 0 ? config.animStop : config.stopTime);
+        m_anim.reset(new AnimationInterface(xml));
+        m_anim->SetStartTime(start);
+        m_anim->SetStopTime(stop);
+        m_anim->SetMobilityPollInterval(Seconds(config.animPollInterval));
+        if (!config.animPackets)
+        {
+            m_anim->SkipPacketTracing();
+        }
 
-    AdHocNetwork();
+        std::set<uint32_t> ids = ParseIdList(config.animNodes);
+        if (ids.empty())
+        {
+            m_anim->EnableIpv4RouteTracking(routes, start, stop, Seconds(0.25));
+        }
+        else
+        {
+            NodeContainer nodes;
+            for (uint32_t id : ids)
+            {
+                nodes.Add(NodeList::GetNode(id));
+            }
+            m_anim->EnableIpv4RouteTracking(routes, start, stop, nodes, Seconds(0.25));
+        }
+    }
 
-    AdHocNetwork(uint32_t backboneNodes)
+    // Closes the animation files and waits for their compression.
+    void Close()
     {
-        backbone.Create(backboneNodes);
-        mac.SetType("ns3::AdhocWifiMac");
-        wifiChannel.SetPropagationDelay("ns3::ConstantSpeedPropagationDelayModel");
-        wifiChannel.AddPropagationLoss("ns3::FriisPropagationLossModel");
-        wifiPhy.SetChannel(wifiChannel.Create());
-        wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager", "DataMode", StringValue ("OfdmRate54Mbps"));
+        m_anim.reset();
+        m_pipes.clear();
+    }
 
-        backboneDevices = wifi.Install(wifiPhy, mac, backbone);
-        internet.SetRoutingHelper(olsr);
-        internet.Install(backbone);
-        ipAddrs.SetBase("192.168.0.0", "255.255.255.0");
-        interfaces = ipAddrs.Assign(backboneDevices);
-        ipAddrs.NewNetwork();
-        this->setMobilityModel();
-    };
+  private:
+    std::unique_ptr<AnimationInterface> m_anim;
+    std::vector<std::unique_ptr<GzipPipe>> m_pipes;
+};
+
+static void RunScenario(const ScenarioConfig& scenario, const std::string& outputDir);
+
+//
+// Outcome of one worker process.
+//
+struct WorkerResult
+{
+    bool succeeded = false;
+    double wallSeconds = 0;
+    long peakRssKb = 0;
+};
+
+//
+// Runs work(0) .. work(count - 1), each in a forked worker process, with no
+// more than `jobs` workers alive at a time.  The ns-3 simulator is a
+// process-wide singleton, so processes rather than threads give us
+// independent simulations.  Wall-clock time and peak RSS are recorded per
+// worker.
+//
+// MPI does not support fork() once it is initialised, so under MPI the
+// work runs in this process, one item after the other; peak RSS is then
+// the process peak so far.
+//
+static bool g_inProcessWorkers = false;
 
-    AdHocNetwork(AdHocNetwork& parentAdhoc, uint32_t backboneNodes, uint32_t i)
+static std::vector<WorkerResult>
+RunWorkers(uint32_t count, uint32_t jobs, const std::function<void(uint32_t)>& work)
+{
+    typedef std::chrono::steady_clock Clock;
+    std::vector<WorkerResult> results(count);
+    if (g_inProcessWorkers)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            Clock::time_point start = Clock::now();
+            work(i);
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            results[i].succeeded = true;
+            results[i].wallSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+            results[i].peakRssKb = usage.ru_maxrss;
+        }
+        return results;
+    }
+    std::map<pid_t, std::pair<uint32_t, Clock::time_point>> running;
+    uint32_t next = 0;
+    while (next < count || !running.empty())
     {
-        backbone.Create(backboneNodes);
-        mac.SetType("ns3::AdhocWifiMac");
-        wifiChannel.SetPropagationDelay("ns3::ConstantSpeedPropagationDelayModel");
-        wifiChannel.AddPropagationLoss("ns3::FriisPropagationLossModel");
-        wifiPhy.SetChannel(wifiChannel.Create());
-        wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager", "DataMode", StringValue ("OfdmRate24Mbps"));
+        while (running.size() < jobs && next < count)
+        {
+            std::cout.flush();
+            pid_t pid = fork();
+            NS_ABORT_MSG_IF(pid < 0, "fork() failed for worker " << next);
+            if (pid == 0)
+            {
+                work(next);
+                std::cout.flush();
+                _exit(0);
+            }
+            running[pid] = std::make_pair(next, Clock::now());
+            ++next;
+        }
 
+        int status = 0;
+        struct rusage usage;
+        pid_t pid = wait4(-1, &status, 0, &usage);
+        auto it = running.find(pid);
+        if (it != running.end())
+        {
+            WorkerResult& result = results[it->second.first];
+            result.succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            result.wallSeconds =
+                std::chrono::duration<double>(Clock::now() - it->second.second).count();
+            result.peakRssKb = usage.ru_maxrss;
+            running.erase(it);
+        }
+    }
+    return results;
+}
 
-        internet.SetRoutingHelper(parentAdhoc.olsr);
-        parentAdhoc.internet.Install(backbone);
+//
+// Runs the scenario once per replication, each in its own worker process
+// and output directory (outputDir/run-<n>).  Once all workers are done, the
+// per-replication summaries are merged into replications.csv and
+// aggregate.csv (mean, standard deviation and 95% confidence interval of
+// every metric).
+//
+// Under MPI, replication r runs on rank r % ranks (outputDir must be on a
+// shared filesystem) and rank 0 merges once every rank is done.
+//
+static int
+RunReplications(const ScenarioConfig& config,
+                uint32_t replications,
+                uint32_t jobs,
+                const std::string& outputDir,
+                uint32_t rank,
+                uint32_t ranks)
+{
+    std::vector<std::string> runDirs;
+    std::vector<uint32_t> local;
+    for (uint32_t r = 0; r < replications; ++r)
+    {
+        runDirs.push_back(
+            SystemPath::Append(outputDir, "run-" + std::to_string(config.run + r)));
+        if (r % ranks == rank)
+        {
+            local.push_back(r);
+        }
+    }
 
-        backbone.Add(parentAdhoc.backbone.Get(i));
-        backboneDevices = wifi.Install(wifiPhy, mac, backbone);
-        interfaces = ipAddrs.Assign(backboneDevices);
-        ipAddrs.NewNetwork();
+    std::vector<WorkerResult> workers = RunWorkers(local.size(), jobs, [&](uint32_t l) {
+        ScenarioConfig replication = config;
+        replication.run = config.run + local[l];
+        RunScenario(replication, runDirs[local[l]]);
+    });
+    uint32_t failed = std::count_if(workers.begin(), workers.end(), [](const WorkerResult& w) {
+        return !w.succeeded;
+    });
+#ifdef NS3_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    if (rank != 0)
+    {
+        return failed > 0 ? 1 : 0;
+    }
 
-        this->setMobilityModel();
-        mobility.PushReferenceMobilityModel(parentAdhoc.backbone.Get(i));
+    std::vector<std::pair<uint64_t, ReplicationSummary>> results;
+    for (uint32_t r = 0; r < replications; ++r)
+    {
+        ReplicationSummary summary;
+        if (ReadSummary(SystemPath::Append(runDirs[r], "summary.csv"), summary))
+        {
+            results.emplace_back(config.run + r, summary);
+        }
+    }
+    std::cout << "Replications done: " << results.size() << " of " << replications
+              << " succeeded" << std::endl;
+    if (results.empty())
+    {
+        return 1;
     }
 
-  private:
-    void setWifi(uint32_t backboneNodes)
-    {
-        backbone.Create(backboneNodes);
-        mac.SetType("ns3::AdhocWifiMac");
-        wifiChannel.SetPropagationDelay("ns3::ConstantSpeedPropagationDelayModel");
-        wifiChannel.AddPropagationLoss("ns3::FriisPropagationLossModel");
-        wifiPhy.SetChannel(wifiChannel.Create());
-        backboneDevices = wifi.Install(wifiPhy, mac, backbone);
-    };
+    const ReplicationSummary& columns = results.front().second;
+    std::ofstream replicationsFile(SystemPath::Append(outputDir, "replications.csv"));
+    replicationsFile << "Run";
+    for (const auto& metric : columns)
+    {
+        replicationsFile << ";" << metric.first;
+    }
+    replicationsFile << "\n";
+    for (const auto& result : results)
+    {
+        replicationsFile << result.first;
+        for (const auto& metric : result.second)
+        {
+            replicationsFile << ";" << metric.second;
+        }
+        replicationsFile << "\n";
+    }
 
-    void setMobilityModel()
+    std::ofstream aggregateFile(SystemPath::Append(outputDir, "aggregate.csv"));
+    aggregateFile << "Metric;Replications;Mean;StdDev;CI95Low;CI95High\n";
+    for (std::size_t m = 0; m < columns.size(); ++m)
     {
-        pos.SetTypeId("ns3::RandomRectanglePositionAllocator");
-        pos.Set("X", StringValue("ns3::UniformRandomVariable[Min=0.0|Max=500.0]"));
-        pos.Set("Y", StringValue("ns3::UniformRandomVariable[Min=0.0|Max=500.0]"));
-        Ptr<PositionAllocator> alloc = pos.Create()->GetObject<PositionAllocator>();
-        mobility.SetMobilityModel("ns3::RandomWaypointMobilityModel",
-                                  "Speed",
-                                  StringValue("ns3::UniformRandomVariable[Min=0.0|Max=100.0]"),
-                                  "Pause",
-                                  StringValue("ns3::ConstantRandomVariable[Constant=0.0]"),
-                                  "PositionAllocator",
-                                  PointerValue(alloc));
+        double sum = 0;
+        double sumSquares = 0;
+        for (const auto& result : results)
+        {
+            double value = result.second[m].second;
+            sum += value;
+            sumSquares += value * value;
+        }
+        uint32_t n = results.size();
+        double mean = sum / n;
+        double variance = n > 1 ? std::max(0.0, (sumSquares - n * mean * mean) / (n - 1)) : 0;
+        double stddev = std::sqrt(variance);
+        double halfWidth = StudentT95(n - 1) * stddev / std::sqrt(double(n));
+        aggregateFile << columns[m].first << ";" << n << ";" << mean << ";" << stddev << ";"
+                      << mean - halfWidth << ";" << mean + halfWidth << "\n";
+    }
+    return failed > 0 || results.size() < replications ? 1 : 0;
+}
 
-        mobility.SetPositionAllocator(alloc);
-        mobility.Install(backbone);
-    };
-};
+//
+// Values of a comma separated grid list such as "20,40,80", or fallback
+// alone when the list is empty.
+//
+template <typename T>
+static std::vector<T>
+GridValues(const std::string& list, T fallback)
+{
+    std::vector<T> values;
+    for (const std::string& item : SplitList(list))
+    {
+        std::istringstream in(item);
+        T value;
+        NS_ABORT_MSG_IF(!(in >> value) || !(in >> std::ws).eof(), "Bad grid value " << item);
+        values.push_back(value);
+    }
+    if (values.empty())
+    {
+        values.push_back(fallback);
+    }
+    return values;
+}
 
-int
-main(int argc, char* argv[])
+//
+// Scaling benchmark.  Every combination of the listed backboneNodes,
+// infraNodes, stopTime, flow counts and schedulers runs once, one point at
+// a time unless more jobs are allowed, and benchmark.csv gets one row per
+// point with wall-clock time, setup vs run time, executed events, events
+// per second of run time and peak RSS.  With --profile the mean insert and
+// removeNext cost and the largest queue depth are added, and every point
+// keeps its scheduler.csv and scheduler-depth.csv.  Empty lists keep the
+// configured value.
+//
+struct BenchmarkGrid
 {
-    uint32_t backboneNodes = 6; //Esta es la capa 3
-    uint32_t infraNodes = 6; // cantidad de hijos de cada nodo de la capa 3 | capa 2
-    uint32_t infrainfraNodes = 0; // cantidad de hijos de cada nodo de la capa 2 | capa 1
-    uint32_t stopTime = 100;
-    uint32_t maxapps = 24;
-    bool useCourseChangeCallback = true;
-    SeedManager::SetSeed (time(0));
+    std::string backboneNodes;
+    std::string infraNodes;
+    std::string stopTime;
+    std::string flows;
+    std::string schedulers;
+};
 
-    CommandLine cmd(__FILE__);
-    cmd.AddValue("backboneNodes", "number of backbone nodes", backboneNodes);
-    cmd.AddValue("infraNodes", "number of leaf nodes", infraNodes);
-    cmd.AddValue("stopTime", "simulation stop time (seconds)", stopTime);
-    cmd.AddValue("useCourseChangeCallback",
-                 "whether to enable course change tracing",
-                 useCourseChangeCallback);
-    cmd.Parse(argc, argv);
+static int
+RunBenchmark(const ScenarioConfig& config,
+             const BenchmarkGrid& grid,
+             uint32_t jobs,
+             const std::string& outputDir)
+{
+    std::vector<std::string> schedulers = SplitList(grid.schedulers);
+    if (schedulers.empty())
+    {
+        schedulers.push_back(config.scheduler);
+    }
+    for (const std::string& scheduler : schedulers)
+    {
+        GetSchedulerTypeName(scheduler);
+    }
 
-    NS_LOG_INFO("Configure Tracing.");
-    CsmaHelper csma;
-    AsciiTraceHelper ascii;
-    Ptr<OutputStreamWrapper> stream = ascii.CreateFileStream("mixed-wireless.tr");
-    csma.EnableAsciiAll(stream);
-    csma.EnablePcapAll("mixed-wireless", true);
-    csma.Install(NodeContainer::GetGlobal());
-
-    AdHocNetwork myadhoc(backboneNodes); // Cluster Padres
-    myadhoc.internet.EnableAsciiIpv4All(stream);
-    myadhoc.wifiPhy.EnablePcap("mixed-wireless", myadhoc.backboneDevices, true);
-    NS_LOG_INFO("Create Applications.");
+    std::vector<ScenarioConfig> points;
+    for (uint32_t backbone : GridValues(grid.backboneNodes, config.backboneNodes))
+    {
+        for (uint32_t infra : GridValues(grid.infraNodes, config.infraNodes))
+        {
+            for (double stopTime : GridValues(grid.stopTime, config.stopTime))
+            {
+                for (uint32_t flows : GridValues(grid.flows, config.maxapps))
+                {
+                    for (const std::string& scheduler : schedulers)
+                    {
+                        ScenarioConfig point = config;
+                        if (!grid.backboneNodes.empty() || !grid.infraNodes.empty())
+                        {
+                            point.tierFanOut.clear();
+                        }
+                        point.backboneNodes = backbone;
+                        point.infraNodes = infra;
+                        point.stopTime = stopTime;
+                        point.maxapps = flows;
+                        point.scheduler = scheduler;
+                        points.push_back(point);
+                    }
+                }
+            }
+        }
+    }
 
+    auto pointDir = [&outputDir](uint32_t p) {
+        return SystemPath::Append(outputDir, "bench-" + std::to_string(p));
+    };
+    std::vector<WorkerResult> workers =
+        RunWorkers(points.size(), jobs, [&](uint32_t p) { RunScenario(points[p], pointDir(p)); });
 
-    for (uint32_t i = 0; i < backboneNodes; ++i)
+    std::ofstream file(SystemPath::Append(outputDir, "benchmark.csv"));
+    file << "backboneNodes;infraNodes;stopTime;flows;scheduler;nodes;wallSeconds;setupSeconds;"
+            "runSeconds;events;eventsPerSecond;peakRssKb;insertNs;removeNextNs;maxQueueDepth\n";
+    int status = 0;
+    for (uint32_t p = 0; p < points.size(); ++p)
     {
-        NS_LOG_INFO("Configuring wireless network for backbone node " << i);
-        AdHocNetwork myadhocinfra(myadhoc, infraNodes, i); // Cluster de hijos
+        std::map<std::string, double> metrics;
+        ReplicationSummary summary;
+        if (!workers[p].succeeded || !ReadSummary(SystemPath::Append(pointDir(p), "summary.csv"), summary))
+        {
+            status = 1;
+            continue;
+        }
+        metrics.insert(summary.begin(), summary.end());
+        file << points[p].backboneNodes << ";" << points[p].infraNodes << ";" << points[p].stopTime
+             << ";" << points[p].maxapps << ";" << points[p].scheduler << ";" << metrics["nodes"]
+             << ";" << workers[p].wallSeconds << ";" << metrics["setupSeconds"] << ";"
+             << metrics["runSeconds"] << ";" << metrics["events"] << ";"
+             << metrics["eventsPerSecond"] << ";" << workers[p].peakRssKb << ";"
+             << metrics["insertNs"] << ";" << metrics["removeNextNs"] << ";"
+             << metrics["maxQueueDepth"] << "\n";
+    }
+    return status;
+}
 
-        for (uint32_t j= 0; j < infraNodes; j++)
+//
+// Parameter sweep.  Every combination of the listed backboneNodes,
+// infraNodes and infrainfraNodes values is one run, in outputDir/sweep-<n>,
+// and sweep.csv gets the point followed by its whole summary.  With
+// --convergence each run stops once its statistics have settled.  Under MPI
+// point p runs on rank p % ranks and rank 0 writes sweep.csv.
+//
+struct SweepGrid
+{
+    std::string backboneNodes;
+    std::string infraNodes;
+    std::string infrainfraNodes;
+};
+
+static int
+RunSweep(const ScenarioConfig& config,
+         const SweepGrid& grid,
+         uint32_t jobs,
+         const std::string& outputDir,
+         uint32_t rank,
+         uint32_t ranks)
+{
+    std::vector<ScenarioConfig> points;
+    for (uint32_t backbone : GridValues(grid.backboneNodes, config.backboneNodes))
+    {
+        for (uint32_t infra : GridValues(grid.infraNodes, config.infraNodes))
         {
-            if (infrainfraNodes > 0)
+            for (uint32_t infrainfra : GridValues(grid.infrainfraNodes, config.infrainfraNodes))
             {
-                AdHocNetwork myadhocinfra(myadhocinfra, infrainfraNodes, j); // Cluster de hijos
+                ScenarioConfig point = config;
+                point.tierFanOut.clear();
+                point.backboneNodes = backbone;
+                point.infraNodes = infra;
+                point.infrainfraNodes = infrainfra;
+                points.push_back(point);
             }
-            
         }
-        
+    }
+
+    auto pointDir = [&outputDir](uint32_t p) {
+        return SystemPath::Append(outputDir, "sweep-" + std::to_string(p));
+    };
+    std::vector<uint32_t> local;
+    for (uint32_t p = 0; p < points.size(); ++p)
+    {
+        if (p % ranks == rank)
+        {
+            local.push_back(p);
+        }
+    }
+    std::vector<WorkerResult> workers = RunWorkers(local.size(), jobs, [&](uint32_t l) {
+        RunScenario(points[local[l]], pointDir(local[l]));
+    });
+    uint32_t failed = std::count_if(workers.begin(), workers.end(), [](const WorkerResult& w) {
+        return !w.succeeded;
+    });
+#ifdef NS3_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    if (rank != 0)
+    {
+        return failed > 0 ? 1 : 0;
+    }
 
-        myadhocinfra.internet.EnableAsciiIpv4All(stream);
-        myadhocinfra.wifiPhy.EnablePcap("mixed-wireless", myadhocinfra.backboneDevices, true);
-       
+    std::ofstream file(SystemPath::Append(outputDir, "sweep.csv"));
+    bool header = false;
+    uint32_t done = 0;
+    for (uint32_t p = 0; p < points.size(); ++p)
+    {
+        ReplicationSummary summary;
+        if (!ReadSummary(SystemPath::Append(pointDir(p), "summary.csv"), summary))
+        {
+            continue;
+        }
+        if (!header)
+        {
+            file << "backboneNodes;infraNodes;infrainfraNodes";
+            for (const auto& metric : summary)
+            {
+                file << ";" << metric.first;
+            }
+            file << "\n";
+            header = true;
+        }
+        file << points[p].backboneNodes << ";" << points[p].infraNodes << ";"
+             << points[p].infrainfraNodes;
+        for (const auto& metric : summary)
+        {
+            file << ";" << metric.second;
+        }
+        file << "\n";
+        ++done;
     }
+    std::cout << "Sweep done: " << done << " of " << points.size() << " points succeeded" << std::endl;
+    return failed > 0 || done < points.size() ? 1 : 0;
+}
+
+static void
+RunScenario(const ScenarioConfig& scenario, const std::string& outputDir)
+{
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point setupStart = Clock::now();
+    SystemPath::MakeDirectories(outputDir);
+    auto output = [&outputDir](const std::string& name) {
+        return SystemPath::Append(outputDir, name);
+    };
 
-    
-    ApplicationContainer apps;
-    uint16_t port = 49153;
+    //
+    // A resumed run restarts from the last checkpoint in outputDir: its time
+    // 0 is the checkpoint time less an OLSR warm-up, shift seconds into the
+    // original run, and stopTime and appStartTime move by the same amount.
+    // FlowMonitor only sees that last segment, so the flow files and the
+    // summary then come from the restored application flow counters.
+    // Without a checkpoint, a directory with a summary is already done and
+    // any other starts from scratch.
+    //
+    ScenarioConfig config = scenario;
+    CheckpointState checkpoint;
+    bool resumed = config.resume && checkpoint.Load(output("checkpoint.txt"));
+    double shift = 0;
+    if (config.resume && !resumed)
+    {
+        ReplicationSummary done;
+        if (ReadSummary(output("summary.csv"), done))
+        {
+            std::cout << "Nothing to resume in " << outputDir << std::endl;
+            return;
+        }
+    }
+    if (resumed)
+    {
+        NS_ABORT_MSG_IF(checkpoint.time >= config.stopTime,
+                        "Checkpoint at " << checkpoint.time << " s is past stopTime");
+        double warmup = config.olsrWarmup > 0 ? config.olsrWarmup : CheckpointState::RESUME_WARMUP;
+        shift = checkpoint.time - warmup;
+        config.olsrWarmup = warmup;
+        config.appStartTime = std::max(config.appStartTime, checkpoint.time) - shift;
+        config.stopTime -= shift;
+        std::cout << "Resuming at " << checkpoint.time << " s" << std::endl;
+    }
 
-    for (size_t i = 0; i < maxapps; i++)
+    if (config.pooledAlloc)
+    {
+        PoolAllocator::Enable();
+    }
+    // Runs may follow each other in one process (under MPI)
+    g_eventProfile = EventProfile();
+    g_schedulerProfile = SchedulerProfile();
+    g_propagationCache = PropagationCacheStats();
+    RngSeedManager::SetSeed(config.seed);
+    RngSeedManager::SetRun(config.run);
+    std::string schedulerType = GetSchedulerTypeName(config.scheduler);
+    if (config.profileEvents)
     {
-        u_int32_t irand = rand() % NodeContainer::GetGlobal().GetN() ;
-        Ptr<Node> nodeRand = NodeContainer::GetGlobal().Get(irand);
-        Ptr<Ipv4> ipv4Rand = nodeRand->GetObject<Ipv4>();
-        Ipv4Address addrRand = ipv4Rand->GetAddress(1, 0).GetLocal();
+        ObjectFactory profiling("ns3::ProfilingScheduler");
+        profiling.Set("Inner", TypeIdValue(TypeId::LookupByName(schedulerType)));
+        Simulator::SetScheduler(profiling);
+    }
+    else
+    {
+        Simulator::SetScheduler(ObjectFactory(schedulerType));
+    }
+    NS_ABORT_MSG_IF(config.statsFormat != "csv" && config.statsFormat != "binary" &&
+                        config.statsFormat != "both",
+                    "Unknown stats format " << config.statsFormat);
+
+    NS_LOG_INFO("Configure Tracing.");
+    TraceManager traces(config, outputDir);
 
-        u_int32_t irandorigin = rand() % NodeContainer::GetGlobal().GetN() ;
-        Ptr<Node> node = NodeContainer::GetGlobal().Get(i);
-        Ptr<Ipv4> ipv4 = node->GetObject<Ipv4>();
-        Ipv4Address addr = ipv4->GetAddress(1, 0).GetLocal();
-        
-        std::cout << "Node " << i << " has address " << addr << " --> \t";
-        std::cout << "Node " << irand << " has address " << addrRand << std::endl;
+    TopologySnapshot snapshot;
+    if (!config.loadTopology.empty())
+    {
+        NS_ABORT_MSG_IF(!snapshot.Load(config.loadTopology),
+                        "Cannot read topology file " << config.loadTopology);
+    }
+    if (resumed)
+    {
+        snapshot = checkpoint.topology;
+    }
+    HierarchicalNetwork network(config,
+                                config.loadTopology.empty() && !resumed ? nullptr : &snapshot);
+    network.Build(TrafficMatrix::ENDPOINT_STREAM + 1);
+    if (!config.saveTopology.empty())
+    {
+        NS_ABORT_MSG_IF(!network.GetSnapshot().Save(config.saveTopology),
+                        "Cannot write topology file " << config.saveTopology);
+    }
+    const std::vector<ClusterInfo>& clusters = network.GetClusters();
+    for (uint32_t cluster = 0; cluster < clusters.size(); ++cluster)
+    {
+        traces.AddCluster(cluster, clusters[cluster].devices);
+    }
+    std::unique_ptr<ControlPlaneCounter> controlPlane;
+    if (config.controlStats || config.profileEvents)
+    {
+        controlPlane.reset(new ControlPlaneCounter());
+    }
+    std::unique_ptr<TierMacStats> macStats;
+    if (config.macStats)
+    {
+        macStats.reset(new TierMacStats(clusters, network.GetTiers()));
+    }
+    std::unique_ptr<GatewayQueueStats> gatewayQueues;
+    if (config.qos || config.queueStats)
+    {
+        gatewayQueues.reset(new GatewayQueueStats(clusters));
+    }
+    std::unique_ptr<HopLatencyStats> hops;
+    if (config.hopLatency)
+    {
+        hops.reset(new HopLatencyStats(clusters, network.GetTiers().size()));
+    }
+    std::unique_ptr<OracleRouting> oracle;
+    if (config.routing == "oracle")
+    {
+        oracle.reset(new OracleRouting(config, clusters));
+        oracle->Start();
+    }
 
-        AddressValue remoteAddress(InetSocketAddress(addrRand, port));
-        OnOffHelper onoff("ns3::UdpSocketFactory", addrRand);
-        onoff.SetAttribute("Remote", remoteAddress);
-        onoff.SetAttribute("OnTime", StringValue("ns3::ConstantRandomVariable[Constant=1]"));
-        onoff.SetAttribute("OffTime", StringValue("ns3::ConstantRandomVariable[Constant=0]"));
-        onoff.SetAttribute("PacketSize", UintegerValue(512));
-        onoff.SetAttribute("DataRate", StringValue("1Mb/s"));
-        apps = onoff.Install(NodeContainer::GetGlobal());
-        apps.Start(Seconds(3.0));
-        apps.Stop(Seconds(stopTime));
+    NS_LOG_INFO("Create Applications.");
+    OnlineFlowStats online(clusters);
+    TrafficMatrix traffic(config, clusters);
+    ApplicationContainer apps = traffic.Install(49153, online);
+    if (resumed)
+    {
+        NS_ABORT_MSG_IF(!online.Restore(checkpoint.state, shift),
+                        "The checkpoint does not match the flows of this run");
     }
-    
+
     //Config::Connect("/NodeList/*/ApplicationList/0/$ns3::OnOffApplication/Tx", MakeCallback(&TxCallback));
     //Config::Connect("/NodeList/*/ApplicationList/1/$ns3::PacketSink/Rx", MakeCallback(&RxCallback));
 
@@ -299,67 +4974,398 @@ main(int argc, char* argv[])
 
 
     FlowMonitorHelper flowMonitorHelper;
-    Ptr<FlowMonitor> flowMonitor = flowMonitorHelper.InstallAll();
-    AnimationInterface anim("mixed-wireless.xml");
-    anim.EnableIpv4RouteTracking("mixed-wireless-route-tracking.xml", Seconds(0), Seconds(9), Seconds(0.25));
+    Ptr<FlowMonitor> flowMonitor;
+    if (network.GetLeaves().GetN() == 0)
+    {
+        flowMonitor = flowMonitorHelper.InstallAll();
+    }
+    else
+    {
+        // Probes on the routers and only on the leaves that carry a flow
+        std::set<uint32_t> probed;
+        for (uint32_t n = 0; n < NodeList::GetNNodes(); ++n)
+        {
+            probed.insert(n);
+        }
+        const NodeContainer& leaves = network.GetLeaves();
+        for (uint32_t i = 0; i < leaves.GetN(); ++i)
+        {
+            probed.erase(leaves.Get(i)->GetId());
+        }
+        const NodeContainer& endpoints = traffic.GetEndpoints();
+        for (uint32_t i = 0; i < endpoints.GetN(); ++i)
+        {
+            probed.insert(endpoints.Get(i)->GetId());
+        }
+        NodeContainer probes;
+        for (uint32_t id : probed)
+        {
+            probes.Add(NodeList::GetNode(id));
+        }
+        flowMonitor = flowMonitorHelper.Install(probes);
+    }
+    // Before any writer thread starts: the recorder may fork gzip
+    std::unique_ptr<AnimationRecorder> animation;
+    if (config.animation)
+    {
+        animation.reset(new AnimationRecorder(config, outputDir));
+    }
+    std::unique_ptr<FlowSampler> sampler;
+    if (config.sampleInterval > 0)
+    {
+        sampler.reset(new FlowSampler(online,
+                                      Seconds(config.sampleInterval),
+                                      config.sampleBuffer,
+                                      output("samples.csv"),
+                                      resumed));
+        NS_ABORT_MSG_IF(resumed && !sampler->Restore(checkpoint.state, shift),
+                        "Cannot restore the samples of the checkpoint");
+        sampler->Start();
+    }
+    std::unique_ptr<ConvergenceMonitor> convergence;
+    if (config.convergence > 0)
+    {
+        NS_ABORT_MSG_IF(config.convergenceInterval <= 0, "convergenceInterval must be positive");
+        convergence.reset(new ConvergenceMonitor(online, config, shift, output("convergence.csv")));
+        convergence->Start();
+    }
+    std::unique_ptr<MetricsExporter> metrics;
+    if (!config.metrics.empty())
+    {
+        NS_ABORT_MSG_IF(config.metricsInterval <= 0, "metricsInterval must be positive");
+        metrics.reset(new MetricsExporter(online, config, shift, outputDir));
+    }
+    std::unique_ptr<Checkpointer> checkpointer;
+    if (config.checkpointInterval > 0)
+    {
+        checkpointer.reset(new Checkpointer(network, online, sampler.get(), shift, output("checkpoint.txt")));
+        checkpointer->Start(Seconds(config.checkpointInterval), Seconds(config.stopTime));
+    }
 
     NS_LOG_INFO("Run Simulation.");
     std::cout<<"Run Simulation"<<std::endl;
-    Simulator::Stop(Seconds(stopTime));
+    Simulator::Stop(Seconds(config.stopTime));
+    Clock::time_point runStart = Clock::now();
+    if (metrics)
+    {
+        metrics->Start();
+    }
     Simulator::Run();
+    Clock::time_point runEnd = Clock::now();
+    ProfilingScheduler::Finish();
 
     std::cout<<"Simulation Done"<<std::endl;
+    if (convergence && convergence->HasConverged())
+    {
+        // Rates below are over the time actually simulated
+        config.stopTime = Simulator::Now().GetSeconds();
+        std::cout << "Converged at " << config.stopTime + shift << " s" << std::endl;
+    }
+    if (sampler)
+    {
+        sampler->Stop();
+    }
+    if (metrics)
+    {
+        metrics->Stop();
+    }
+    if (animation)
+    {
+        animation->Close();
+    }
 
     flowMonitor->CheckForLostPackets();
-    flowMonitor->SerializeToXmlFile("mixed-wireless-flow-monitor.xml", false, false);
+    // FlowMonitor starts afresh on resume, so the XML would only cover the
+    // last segment
+    if (traces.IsFlowStatsEnabled() && config.flowXml && !resumed)
+    {
+        flowMonitor->SerializeToXmlFile(output("mixed-wireless-flow-monitor.xml"), false, false);
+    }
     //Obtener estadísticas de flujo
-    std::map<FlowId, FlowMonitor::FlowStats> stats = flowMonitor->GetFlowStats();  
+    const FlowMonitor::FlowStatsContainer& stats = flowMonitor->GetFlowStats();
     Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier> (flowMonitorHelper.GetClassifier ());
-    std::ofstream myfile("data.csv");
-    std::unordered_map<std::string, double> valores;
-    std::unordered_map<std::string, double> cantidades;
-    myfile << "Source Address;Destination Address;TxBytes;RxBytes;FirstTxPacket;LastTxPacket;Duration;Delay;Jitter;LostPackets;TxBitrate;average traffic" << std::endl;
-
-
-
-    // Imprimir txBitrate de cada flujo
-    for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin(); i != stats.end(); ++i) {
-        Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow (i->first);
-        std::stringstream buffer;
-        buffer << t.sourceAddress;
-        std::string contenido = buffer.str();
-        double bitrate = (i->second.txBytes * 8.0) / (i->second.timeLastTxPacket.GetSeconds() - i->second.timeFirstTxPacket.GetSeconds()) / 1000;
-        double Duration = i->second.timeLastTxPacket.GetSeconds() - i->second.timeFirstTxPacket.GetSeconds();
-        double timemax = i->second.timeLastTxPacket.GetSeconds();
-        double percentage = (Duration / timemax);
-        double average = bitrate * percentage;
-        valores[contenido] += percentage * (bitrate);
-        cantidades[contenido] += 1;
-
-        myfile 
-        << t.sourceAddress 
-        << ";" << t.destinationAddress
-        << ";" << i->second.txBytes  
-        << ";" << i->second.rxBytes 
-        << ";" << i->second.timeFirstTxPacket.GetSeconds() 
-        << ";" << timemax
-        << ";" << Duration
-        << ";" << i->second.delaySum.GetSeconds() / i->second.rxPackets
-        << ";" << i->second.jitterSum.GetSeconds() / (i->second.rxPackets - 1)
-        << ";" << i->second.lostPackets 
-        << ";" << bitrate
-        << ";" << average << std::endl;    
-    }
-
-    std::ofstream resumenfile("resumen.csv");
-    resumenfile << "Source Address;average traffic" << std::endl;
-    for (const auto& par : valores) {
-        resumenfile << par.first << ";" << par.second << ";" << cantidades[par.first] << std::endl;
-    }
-
-
-    resumenfile.close();
-    myfile.close();
+    FlowStatsWriter flowStats = resumed ? FlowStatsWriter(online) : FlowStatsWriter(stats, classifier);
+    // Traffic period of the whole run, the resumed part included
+    double activeTime = config.stopTime + shift - scenario.appStartTime;
+    if (config.statsFormat == "binary" || config.statsFormat == "both")
+    {
+        flowStats.WriteBinary(output("flows.bin"));
+    }
+    if (config.statsFormat == "csv" || config.statsFormat == "both")
+    {
+        flowStats.WriteCsv(output("data.csv"));
+        flowStats.WriteClusterSummaries(clusters, activeTime, output("clusters.csv"), output("tiers.csv"));
+        flowStats.WriteSourceSummaries(activeTime, output("sources.csv"));
+        online.WriteSourceSummary(output("resumen.csv"));
+        online.WriteHistograms(output("histograms.csv"));
+        if (macStats)
+        {
+            macStats->Write(output("tier-mac.csv"), config.stopTime - config.appStartTime);
+        }
+        if (gatewayQueues)
+        {
+            gatewayQueues->Write(output("gateway-queues.csv"));
+        }
+        if (hops)
+        {
+            hops->Write(output("hops.csv"));
+        }
+    }
+    ReplicationSummary summary = SummarizeFlows(online, activeTime);
+    double runSeconds = std::chrono::duration<double>(runEnd - runStart).count();
+    summary.emplace_back("nodes", NodeList::GetNNodes());
+    if (controlPlane)
+    {
+        summary.emplace_back("controlPackets", controlPlane->GetPackets());
+        summary.emplace_back("controlBytes", controlPlane->GetBytes());
+    }
+    summary.emplace_back("routeRecomputations", oracle ? oracle->GetRecomputations() : 0);
+    if (macStats)
+    {
+        summary.emplace_back("macRetries", macStats->GetRetries());
+        summary.emplace_back("macFinalFailures", macStats->GetFinalFailures());
+    }
+    summary.emplace_back("convergedAt",
+                         convergence && convergence->HasConverged() ? config.stopTime + shift : 0);
+    summary.emplace_back("events", Simulator::GetEventCount());
+    summary.emplace_back("setupSeconds", std::chrono::duration<double>(runStart - setupStart).count());
+    summary.emplace_back("runSeconds", runSeconds);
+    summary.emplace_back("eventsPerSecond", runSeconds > 0 ? Simulator::GetEventCount() / runSeconds : 0);
+    if (config.propagationCacheTolerance > 0)
+    {
+        summary.emplace_back("propagationHits", g_propagationCache.hits);
+        summary.emplace_back("propagationMisses", g_propagationCache.misses);
+        summary.emplace_back("propagationHitNs", g_propagationCache.GetHitNs());
+        summary.emplace_back("propagationInnerNs", g_propagationCache.GetInnerNs());
+    }
+    if (config.profileEvents)
+    {
+        summary.emplace_back("insertNs", g_schedulerProfile.GetMeanNs(SchedulerProfile::INSERT));
+        summary.emplace_back("removeNextNs", g_schedulerProfile.GetMeanNs(SchedulerProfile::REMOVE_NEXT));
+        summary.emplace_back("maxQueueDepth", g_schedulerProfile.maxDepth);
+    }
+    WriteSummary(summary, output("summary.csv"));
+    traces.Report();
+    if (config.profileEvents)
+    {
+        g_eventProfile.Write(output("profile.csv"));
+        g_schedulerProfile.Write(config.scheduler, output("scheduler.csv"), output("scheduler-depth.csv"));
+        if (config.pooledAlloc)
+        {
+            PoolAllocator::Write(output("allocator.csv"));
+        }
+    }
+    // The results are complete, a later resume must not redo the tail
+    std::remove(output("checkpoint.txt").c_str());
     Simulator::Destroy();
-    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    ScenarioConfig config;
+    uint32_t replications = 1;
+    uint32_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::string outputDir = ".";
+    bool benchmark = false;
+    uint32_t benchmarkJobs = 1;
+    BenchmarkGrid grid;
+    bool sweep = false;
+    SweepGrid sweepGrid;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("backboneNodes", "number of backbone nodes", config.backboneNodes);
+    cmd.AddValue("infraNodes", "number of leaf nodes", config.infraNodes);
+    cmd.AddValue("infrainfraNodes", "number of nodes below each leaf node", config.infrainfraNodes);
+    cmd.AddValue("tiers",
+                 "comma separated fan-out per level, overrides backboneNodes/infraNodes/infrainfraNodes",
+                 config.tierFanOut);
+    cmd.AddValue("tierDataModes", "comma separated constant data mode per level", config.tierDataModes);
+    cmd.AddValue("tierStandards",
+                 "comma separated wifi standard per level: default (WifiHelper's, with its "
+                 "channel), 80211a, 80211g, 80211n, 80211ac or 80211ax",
+                 config.tierStandards);
+    cmd.AddValue("tierChannelWidths",
+                 "comma separated channel width (MHz) per level with a standard other than default",
+                 config.tierChannelWidths);
+    cmd.AddValue("tierMaxAmpdu",
+                 "comma separated maximum A-MPDU size (bytes, 0 disables) per level, 802.11n and later",
+                 config.tierMaxAmpdu);
+    cmd.AddValue("tierMaxAmsdu",
+                 "comma separated maximum A-MSDU size (bytes, 0 disables) per level, 802.11n and later",
+                 config.tierMaxAmsdu);
+    cmd.AddValue("qos", "EDCA MACs on every tier, with OLSR control in AC_VO", config.qos);
+    cmd.AddValue("latencyFlows", "number of flows marked EF (AC_VI with qos)", config.latencyFlows);
+    cmd.AddValue("hopLatency", "time unicast data frames to split per-hop queueing, airtime and forwarding per tier", config.hopLatency);
+    cmd.AddValue("queueStats",
+                 "time gateway MAC queues up to the first transmission into gateway-queues.csv "
+                 "(implied by qos)",
+                 config.queueStats);
+    cmd.AddValue("macStats",
+                 "count PPDUs, aggregated MPDUs/MSDUs, retries and drops per tier into tier-mac.csv",
+                 config.macStats);
+    cmd.AddValue("tierRateManagers",
+                 "comma separated rate manager per level: constant, minstrel or ideal",
+                 config.tierRateManagers);
+    cmd.AddValue("fieldSize", "side (m) of the square each level moves in", config.fieldSize);
+    cmd.AddValue("stopTime", "simulation stop time (seconds)", config.stopTime);
+    cmd.AddValue("flows", "number of traffic flows", config.maxapps);
+    cmd.AddValue("trafficPolicy",
+                 "flow endpoint selection: uniform, intra, cross or hotspot",
+                 config.trafficPolicy);
+    cmd.AddValue("flowRate", "offered load of each flow", config.flowRate);
+    cmd.AddValue("packetSize", "UDP payload size of each flow (bytes)", config.packetSize);
+    cmd.AddValue("hotspotCluster", "child cluster whose gateway receives hotspot traffic", config.hotspotCluster);
+    cmd.AddValue("routing", "routing protocol: olsr, aodv, dsdv or oracle", config.routing);
+    cmd.AddValue("controlStats",
+                 "count routing control packets and bytes into the summary",
+                 config.controlStats);
+    cmd.AddValue("oracleRange",
+                 "link range (m) of the oracle routing (0 links every pair in a cluster)",
+                 config.oracleRange);
+    cmd.AddValue("oracleInterval", "period (s) of oracle link checks when oracleRange is set", config.oracleInterval);
+    cmd.AddValue("olsrWarmup",
+                 "with OLSR routing, run it with fast intervals for this long (s) and start traffic "
+                 "after it (0 disables)",
+                 config.olsrWarmup);
+    cmd.AddValue("useCourseChangeCallback",
+                 "whether to enable course change tracing",
+                 config.useCourseChangeCallback);
+    cmd.AddValue("replications", "number of independent replications to run", replications);
+    cmd.AddValue("jobs", "maximum number of replications running in parallel", jobs);
+    cmd.AddValue("seed", "RngSeedManager seed shared by all replications", config.seed);
+    cmd.AddValue("run", "RngSeedManager run number of the first replication", config.run);
+    cmd.AddValue("outputDir", "directory for traces and statistics", outputDir);
+    cmd.AddValue("animation", "record NetAnim XML output", config.animation);
+    cmd.AddValue("animStart", "start (s) of the animation window", config.animStart);
+    cmd.AddValue("animStop", "end (s) of the animation window (0 is stopTime)", config.animStop);
+    cmd.AddValue("animNodes", "comma separated node ids whose routes are tracked (default all)", config.animNodes);
+    cmd.AddValue("animPackets", "record packets in the animation", config.animPackets);
+    cmd.AddValue("animPoll", "animation mobility poll interval (s)", config.animPollInterval);
+    cmd.AddValue("animCompress", "stream the animation XML through gzip", config.animCompress);
+    cmd.AddValue("profile", "count events and CPU time per module into profile.csv", config.profileEvents);
+    cmd.AddValue("scheduler",
+                 "event queue: map, heap, calendar, list or priority-queue",
+                 config.scheduler);
+    cmd.AddValue("pooledAlloc",
+                 "serve small allocations from size-class pools (hit rates in allocator.csv with profile)",
+                 config.pooledAlloc);
+    cmd.AddValue("sampleInterval", "period (s) of flow statistics samples (0 disables)", config.sampleInterval);
+    cmd.AddValue("sampleBuffer", "capacity of the flow sample ring buffer", config.sampleBuffer);
+    cmd.AddValue("statsFormat", "flow statistics output: csv, binary or both", config.statsFormat);
+    cmd.AddValue("flowXml", "write the FlowMonitor XML export (needs traceLevel flows or above)", config.flowXml);
+    cmd.AddValue("saveTopology", "write the built topology to this file", config.saveTopology);
+    cmd.AddValue("loadTopology",
+                 "rebuild the tiers and initial positions saved in this file",
+                 config.loadTopology);
+    cmd.AddValue("checkpointInterval",
+                 "period (s) of checkpoint.txt in the output directory (0 disables)",
+                 config.checkpointInterval);
+    cmd.AddValue("resume",
+                 "continue from checkpoint.txt in the output directory up to stopTime",
+                 config.resume);
+    cmd.AddValue("traceLevel", "tracing level: off, flows, cluster or full", config.traceLevel);
+    cmd.AddValue("traceNodes", "comma separated node ids to trace (default all)", config.traceNodes);
+    cmd.AddValue("traceClusters",
+                 "comma separated cluster ids traced at the cluster level (0 is the backbone)",
+                 config.traceClusters);
+    cmd.AddValue("sharedChannels",
+                 "use one wifi channel per tier instead of one per cluster; there is no spatial "
+                 "index, so each transmission schedules an event and a PPDU copy for every PHY "
+                 "of the tier and its cost grows with the tier, not the cluster",
+                 config.sharedChannels);
+    cmd.AddValue("interferenceCutoff",
+                 "range (m) beyond which receivers are not delivered to (0 is unlimited)",
+                 config.interferenceCutoff);
+    cmd.AddValue("propagationCache",
+                 "distance drift (m) over which cached Friis losses are reused (0 disables)",
+                 config.propagationCacheTolerance);
+    cmd.AddValue("coalescedMobility",
+                 "compose child cluster positions once per course change instead of per query",
+                 config.coalescedMobility);
+    cmd.AddValue("lightweightLeaves",
+                 "bottom tier nodes get static default routes instead of OLSR and are only probed when they carry a flow",
+                 config.lightweightLeaves);
+    cmd.AddValue("traceBudget", "maximum size in bytes of each trace file (0 is unlimited)", config.traceBudget);
+    cmd.AddValue("benchmark", "run the scaling benchmark over the bench* lists", benchmark);
+    cmd.AddValue("benchBackbone", "comma separated backboneNodes values to benchmark", grid.backboneNodes);
+    cmd.AddValue("benchInfra", "comma separated infraNodes values to benchmark", grid.infraNodes);
+    cmd.AddValue("benchStopTime", "comma separated stopTime values to benchmark", grid.stopTime);
+    cmd.AddValue("benchFlows", "comma separated flow counts to benchmark", grid.flows);
+    cmd.AddValue("benchSchedulers", "comma separated schedulers to benchmark", grid.schedulers);
+    cmd.AddValue("benchJobs", "benchmark points run in parallel", benchmarkJobs);
+    cmd.AddValue("sweep", "run every point of the sweep* lists, jobs at a time", sweep);
+    cmd.AddValue("sweepBackbone", "comma separated backboneNodes values to sweep", sweepGrid.backboneNodes);
+    cmd.AddValue("sweepInfra", "comma separated infraNodes values to sweep", sweepGrid.infraNodes);
+    cmd.AddValue("sweepInfraInfra",
+                 "comma separated infrainfraNodes values to sweep",
+                 sweepGrid.infrainfraNodes);
+    cmd.AddValue("convergence",
+                 "stop once the 95% CI half-width of goodput and delay is below this share of "
+                 "their mean (0 disables)",
+                 config.convergence);
+    cmd.AddValue("metrics",
+                 "live metrics in the output directory: json (metrics.json) or prometheus "
+                 "(metrics.prom)",
+                 config.metrics);
+    cmd.AddValue("metricsInterval", "wall-clock period (s) of the live metrics", config.metricsInterval);
+    cmd.AddValue("convergenceInterval", "batch length (s) of the convergence test", config.convergenceInterval);
+    cmd.AddValue("convergenceMinBatches",
+                 "batches needed before the convergence test can stop a run",
+                 config.convergenceMinBatches);
+    cmd.Parse(argc, argv);
+    // Other routing protocols have no warm-up to wait for
+    if (config.routing == "olsr" && config.olsrWarmup > 0)
+    {
+        config.appStartTime = config.olsrWarmup;
+    }
+
+    //
+    // The clusters are wifi channels, which ns-3's distributed simulator
+    // cannot split across ranks (only point-to-point links can be remote),
+    // so under MPI the ranks share the replications instead.  MPI is only
+    // used here, to find the rank and to wait for the others; every run
+    // keeps the default simulator and runs in this process.
+    //
+    uint32_t rank = 0;
+    uint32_t ranks = 1;
+#ifdef NS3_MPI
+    MPI_Init(&argc, &argv);
+    int mpiRank = 0;
+    int mpiSize = 1;
+    MPI_Comm_rank(MPI_COMM_WORLD, &mpiRank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpiSize);
+    rank = mpiRank;
+    ranks = mpiSize;
+    g_inProcessWorkers = true;
+#endif
+
+    int status = 0;
+    if (benchmark)
+    {
+        if (rank == 0)
+        {
+            status = RunBenchmark(config, grid, std::max(1u, benchmarkJobs), outputDir);
+        }
+    }
+    else if (sweep)
+    {
+        status = RunSweep(config, sweepGrid, std::max(1u, jobs), outputDir, rank, ranks);
+    }
+    else if (replications <= 1)
+    {
+        if (rank == 0)
+        {
+            RunScenario(config, outputDir);
+        }
+    }
+    else
+    {
+        status = RunReplications(config, replications, std::max(1u, jobs), outputDir, rank, ranks);
+    }
+
+#ifdef NS3_MPI
+    MPI_Finalize();
+#endif
+    return status;
 }
\ No newline at end of file